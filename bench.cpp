@@ -0,0 +1,1112 @@
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "roaring.hh"
+#include "roaring64bsi.hh"
+#include "roaring64bsiview.hh"
+#include "roaring64eqindex.hh"
+#include "roaring64rangebsi.hh"
+
+// 性能测试：./bench [rows]，默认 2M 行，数值均匀分布在 [0, 2^32)。
+
+namespace {
+
+constexpr uint64_t kDefaultRows = 2'000'000;
+constexpr int kRepeat = 5;
+
+// returns the best wall time of kRepeat runs, in milliseconds
+auto timeIt(const std::function<void()>& fn) -> double {
+    double best = 0;
+    for (int r = 0; r < kRepeat; r++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+        if (r == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+void report(std::string_view name, double baselineMs, double candidateMs) {
+    fmt::print("  {:<28} baseline {:>9.2f} ms   new {:>9.2f} ms   speedup {:>5.2f}x\n", name,
+               baselineMs, candidateMs, baselineMs / candidateMs);
+}
+
+auto buildBsi(uint64_t rows, uint64_t maxValue) -> roaring::Roaring64Bsi {
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> dist(0, maxValue);
+
+    roaring::Roaring64Bsi bsi;
+    std::vector<std::tuple<uint64_t, uint64_t>> rowsVec;
+    rowsVec.reserve(rows);
+    for (uint64_t id = 0; id < rows; id++) {
+        rowsVec.emplace_back(id, dist(rng));
+    }
+    bsi.setValues(rowsVec);
+    return bsi;
+}
+
+// the generic three-accumulator O'Neil loop the compare kernels replaced
+auto genericONeil(const roaring::Roaring64Bsi& bsi, roaring::BsiOperation operation,
+                  uint64_t predicate) -> roaring::Roaring64Map {
+    roaring::Roaring64Map gtBitMap;
+    roaring::Roaring64Map ltBitMap;
+    roaring::Roaring64Map eqBitMap = bsi.getExistenceBitmap();
+
+    for (int32_t i = bsi.bitCount() - 1; i >= 0; i--) {
+        const auto& slice = bsi.getSlice(i);
+        if (((predicate >> i) & 1) == 1) {
+            ltBitMap |= (eqBitMap - slice);
+            eqBitMap &= slice;
+        } else {
+            gtBitMap |= (eqBitMap & slice);
+            eqBitMap -= slice;
+        }
+    }
+
+    switch (operation) {
+    case roaring::EQ:
+        return eqBitMap;
+    case roaring::NEQ:
+        return bsi.getExistenceBitmap() - eqBitMap;
+    case roaring::GT:
+        return gtBitMap;
+    case roaring::LT:
+        return ltBitMap;
+    case roaring::GE:
+        return gtBitMap | eqBitMap;
+    case roaring::LE:
+        return ltBitMap | eqBitMap;
+    default:
+        return {};
+    }
+}
+
+auto opName(roaring::BsiOperation operation) -> std::string_view {
+    switch (operation) {
+    case roaring::EQ:
+        return "EQ";
+    case roaring::NEQ:
+        return "NEQ";
+    case roaring::LE:
+        return "LE";
+    case roaring::LT:
+        return "LT";
+    case roaring::GE:
+        return "GE";
+    case roaring::GT:
+        return "GT";
+    case roaring::RANGE:
+        return "RANGE";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+void benchCompareKernels(uint64_t rows) {
+    fmt::print("compare kernels vs generic O'Neil loop ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+    const uint64_t predicate = 0x9E3779B9ULL;
+
+    for (auto operation : {roaring::EQ, roaring::NEQ, roaring::GT, roaring::GE, roaring::LT,
+                           roaring::LE}) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline = timeIt([&] {
+            baselineCard = genericONeil(bsi, operation, predicate).cardinality();
+        });
+        double candidate = timeIt([&] {
+            candidateCard = bsi.compare(operation, predicate, 0)->cardinality();
+        });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(opName(operation), baseline, candidate);
+    }
+}
+
+void benchRange(uint64_t rows) {
+    fmt::print("RANGE: fused single pass vs GE & LE ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+
+    const std::vector<std::pair<uint64_t, uint64_t>> ranges {
+            {0x10000000ULL, 0x20000000ULL}, // wide range
+            {0x9E370000ULL, 0x9E37FFFFULL}, // long shared prefix
+            {0x7FFFFFFFULL, 0x80000000ULL}, // no shared prefix
+    };
+    for (const auto& [start, end] : ranges) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline = timeIt([&] {
+            auto left = bsi.compare(roaring::GE, start, 0);
+            auto right = bsi.compare(roaring::LE, end, 0);
+            baselineCard = (*left & *right).cardinality();
+        });
+        double candidate = timeIt([&] {
+            candidateCard = bsi.compare(roaring::RANGE, start, end)->cardinality();
+        });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(fmt::format("[{:#x}, {:#x}]", start, end), baseline, candidate);
+    }
+}
+
+void benchFoundSetPushDown(uint64_t rows) {
+    fmt::print("selective foundSet: pushed down vs applied after the scan ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<uint64_t> dist(0, rows - 1);
+    roaring::Roaring64Map foundSet;
+    for (int i = 0; i < 5000; i++) {
+        foundSet.add(dist(rng));
+    }
+
+    const uint64_t predicate = 0x9E3779B9ULL;
+    for (auto operation : {roaring::EQ, roaring::GT, roaring::LE}) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline = timeIt([&] {
+            baselineCard = (*bsi.compare(operation, predicate, 0) & foundSet).cardinality();
+        });
+        double candidate = timeIt([&] {
+            candidateCard = bsi.compare(operation, predicate, 0, &foundSet)->cardinality();
+        });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(opName(operation), baseline, candidate);
+    }
+}
+
+void benchCountCompare(uint64_t rows) {
+    fmt::print("countCompare vs compare()->cardinality() ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+
+    std::mt19937_64 rng(11);
+    std::uniform_int_distribution<uint64_t> dist(0, 3);
+    roaring::Roaring64Map foundSet;
+    for (uint64_t id = 0; id < rows; id++) {
+        if (dist(rng) != 0) {
+            foundSet.add(id);
+        }
+    }
+
+    const uint64_t predicate = 0x9E3779B9ULL;
+    for (auto operation : {roaring::EQ, roaring::NEQ, roaring::GE, roaring::LT, roaring::RANGE}) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline = timeIt([&] {
+            baselineCard =
+                    bsi.compare(operation, predicate, predicate << 1, &foundSet)->cardinality();
+        });
+        double candidate = timeIt([&] {
+            candidateCard = bsi.countCompare(operation, predicate, predicate << 1, &foundSet);
+        });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(opName(operation), baseline, candidate);
+    }
+
+    // min/max shortcut: every row matches
+    double baseline =
+            timeIt([&] { (void)bsi.compare(roaring::GE, 0, 0, &foundSet)->cardinality(); });
+    double candidate = timeIt([&] { (void)bsi.countCompare(roaring::GE, 0, 0, &foundSet); });
+    report("GE 0 (shortcut)", baseline, candidate);
+}
+
+void benchParallelScaling(uint64_t rows) {
+    constexpr uint64_t kChunks = 256;
+    fmt::print("chunk-parallel scaling ({} rows over {} high keys)\n", rows, kChunks);
+
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> dist(0, UINT32_MAX);
+    std::vector<std::tuple<uint64_t, uint64_t>> rowsVec;
+    rowsVec.reserve(rows);
+    for (uint64_t i = 0; i < rows; i++) {
+        rowsVec.emplace_back(((i % kChunks) << 32) | (i / kChunks), dist(rng));
+    }
+    roaring::Roaring64Bsi bsi;
+    bsi.setValues(rowsVec);
+
+    const uint64_t predicate = 0x9E3779B9ULL;
+    double compareSerial = 0;
+    double sumSerial = 0;
+    double topKSerial = 0;
+    size_t maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        bsi.setThreadPool(std::make_shared<roaring::ThreadPool>(threads));
+        double compareMs = timeIt([&] { (void)bsi.compare(roaring::GE, predicate, 0); });
+        double sumMs = timeIt([&] { (void)bsi.sum(nullptr); });
+        double topKMs = timeIt([&] { (void)bsi.topK(1000); });
+        if (threads == 1) {
+            compareSerial = compareMs;
+            sumSerial = sumMs;
+            topKSerial = topKMs;
+        }
+        fmt::print("  {:>3} threads   compare {:>8.2f} ms ({:>4.2f}x)   sum {:>8.2f} ms ({:>4.2f}x)"
+                   "   topK {:>8.2f} ms ({:>4.2f}x)\n",
+                   threads, compareMs, compareSerial / compareMs, sumMs, sumSerial / sumMs, topKMs,
+                   topKSerial / topKMs);
+    }
+}
+
+void benchBulkLoad(uint64_t rows) {
+    fmt::print("bulk load: setValuesSorted vs per-row setValue ({} rows, 40-bit values)\n", rows);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> dist(0, (1ULL << 40) - 1);
+    std::vector<uint64_t> columnIds(rows);
+    std::vector<uint64_t> values(rows);
+    for (uint64_t i = 0; i < rows; i++) {
+        columnIds[i] = i * 3;
+        values[i] = dist(rng);
+    }
+
+    uint64_t baselineSum = 0;
+    uint64_t candidateSum = 0;
+    double baseline = timeIt([&] {
+        roaring::Roaring64Bsi bsi;
+        for (uint64_t i = 0; i < rows; i++) {
+            bsi.setValue(columnIds[i], values[i]);
+        }
+        baselineSum = std::get<0>(bsi.sum(nullptr));
+    });
+    double candidate = timeIt([&] {
+        roaring::Roaring64Bsi bsi;
+        bsi.setValuesSorted(columnIds, values);
+        candidateSum = std::get<0>(bsi.sum(nullptr));
+    });
+    if (baselineSum != candidateSum) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineSum, candidateSum);
+        std::exit(1);
+    }
+    report("fresh index", baseline, candidate);
+}
+
+void benchDecode(uint64_t rows) {
+    fmt::print("bulk decode: decodeAll vs per-row getValue ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+    std::vector<uint64_t> baselineValues(rows);
+    std::vector<uint64_t> candidateValues(rows);
+
+    double baseline = timeIt([&] {
+        size_t i = 0;
+        for (uint64_t columnId : bsi.getExistenceBitmap()) {
+            baselineValues[i++] = std::get<0>(bsi.getValue(columnId));
+        }
+    });
+    double candidate = timeIt([&] { bsi.decodeAll(candidateValues); });
+    if (baselineValues != candidateValues) {
+        fmt::print("  result mismatch\n");
+        std::exit(1);
+    }
+    report("decode all", baseline, candidate);
+
+    double transposeMs = timeIt([&] { (void)bsi.transpose(); });
+    fmt::print("  {:<28} {:>9.2f} ms\n", "transpose", transposeMs);
+}
+
+// the per-row getValue/setValue histogram transposeWithCount used to build
+auto perRowHistogram(const roaring::Roaring64Bsi& bsi) -> roaring::Roaring64Bsi {
+    roaring::Roaring64Bsi histogram;
+    for (uint64_t columnId : bsi.getExistenceBitmap()) {
+        auto [value, exists] = bsi.getValue(columnId);
+        auto [count, counted] = histogram.getValue(value);
+        histogram.setValue(value, counted ? count + 1 : 1);
+    }
+    return histogram;
+}
+
+void benchTransposeWithCount(uint64_t rows) {
+    fmt::print("transposeWithCount vs per-row setValue ({} rows)\n", rows);
+    for (uint64_t maxValue : {uint64_t {UINT8_MAX}, uint64_t {UINT32_MAX}}) {
+        auto bsi = buildBsi(rows, maxValue);
+        uint64_t baselineSum = 0;
+        uint64_t candidateSum = 0;
+        double baseline =
+                timeIt([&] { baselineSum = std::get<0>(perRowHistogram(bsi).sum(nullptr)); });
+        double candidate = timeIt(
+                [&] { candidateSum = std::get<0>(bsi.transposeWithCount()->sum(nullptr)); });
+        if (baselineSum != candidateSum) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineSum, candidateSum);
+            std::exit(1);
+        }
+        report(fmt::format("values in [0, {}]", maxValue), baseline, candidate);
+    }
+}
+
+void benchFrozenOpen(uint64_t rows) {
+    fmt::print("open: mmap frozen view vs read + deserialize ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+    auto dir = std::filesystem::temp_directory_path();
+    auto portablePath = (dir / "bsi_bench_portable.bsi").string();
+    auto frozenPath = (dir / "bsi_bench_frozen.bsi").string();
+
+    std::vector<char> portable(bsi.serializedSizeInBytes());
+    bsi.serialize(portable.data());
+    std::ofstream(portablePath, std::ios::binary).write(portable.data(), portable.size());
+    roaring::Roaring64BsiView::write(bsi, frozenPath);
+
+    double baseline = timeIt([&] {
+        std::ifstream in(portablePath, std::ios::binary);
+        std::vector<char> buffer(portable.size());
+        in.read(buffer.data(), buffer.size());
+        roaring::Roaring64Bsi loaded;
+        loaded.deserialize(buffer.data());
+    });
+    double candidate = timeIt([&] { (void)roaring::Roaring64BsiView::open(frozenPath); });
+    report("open", baseline, candidate);
+
+    auto view = roaring::Roaring64BsiView::open(frozenPath);
+    const auto& mappedBsi = **view;
+    const uint64_t predicate = 0x9E3779B9ULL;
+    if (mappedBsi.sum(nullptr) != bsi.sum(nullptr) ||
+        mappedBsi.countCompare(roaring::GE, predicate, 0) !=
+                bsi.countCompare(roaring::GE, predicate, 0)) {
+        fmt::print("  result mismatch\n");
+        std::exit(1);
+    }
+    double heap = timeIt([&] { (void)bsi.compare(roaring::GE, predicate, 0); });
+    double mapped = timeIt([&] { (void)mappedBsi.compare(roaring::GE, predicate, 0); });
+    report("compare GE (heap vs view)", heap, mapped);
+
+    std::filesystem::remove(portablePath);
+    std::filesystem::remove(frozenPath);
+}
+
+void benchLazyOpen(uint64_t rows) {
+    fmt::print("open + top-slice query: deserializeLazy vs deserialize ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+    std::vector<char> legacy(bsi.serializedSizeInBytes());
+    bsi.serialize(legacy.data());
+    std::vector<char> indexed(bsi.indexedSizeInBytes());
+    bsi.serializeIndexed(indexed.data());
+
+    // GE 2^31 only needs the top slice
+    const uint64_t predicate = 1ULL << 31;
+    uint64_t baselineCard = 0;
+    uint64_t candidateCard = 0;
+    double baseline = timeIt([&] {
+        roaring::Roaring64Bsi loaded;
+        loaded.deserialize(legacy.data());
+        baselineCard = loaded.countCompare(roaring::GE, predicate, 0);
+    });
+    double candidate = timeIt([&] {
+        auto loaded = roaring::Roaring64Bsi::deserializeLazy(indexed.data(), indexed.size());
+        candidateCard = loaded->countCompare(roaring::GE, predicate, 0);
+    });
+    if (baselineCard != candidateCard) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+        std::exit(1);
+    }
+    report("GE 2^31", baseline, candidate);
+}
+
+void benchFilter(uint64_t rows) {
+    fmt::print("filter: built from slice & foundSet vs clone then &= ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+    roaring::Roaring64Map foundSet;
+    foundSet.addRange(0, rows / 100);
+
+    uint64_t baselineCard = 0;
+    uint64_t candidateCard = 0;
+    double baseline = timeIt([&] {
+        baselineCard = 0;
+        for (size_t i = 0; i < bsi.bitCount(); i++) {
+            roaring::Roaring64Map slice = bsi.getSlice(i);
+            slice &= foundSet;
+            baselineCard += slice.cardinality();
+        }
+    });
+    double candidate = timeIt([&] {
+        auto filtered = bsi.filter(&foundSet);
+        candidateCard = 0;
+        for (size_t i = 0; i < filtered->bitCount(); i++) {
+            candidateCard += filtered->getSliceCardinality(i);
+        }
+    });
+    if (baselineCard != candidateCard) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+        std::exit(1);
+    }
+    report("filter 1%", baseline, candidate);
+}
+
+// the recursive addDigit that add() used to run for every slice of the addend
+void addDigitRecursive(std::vector<roaring::Roaring64Map>& slices,
+                       const roaring::Roaring64Map& foundSet, size_t i) {
+    roaring::Roaring64Map carry = slices[i] & foundSet;
+    slices[i] ^= foundSet;
+    if (!carry.isEmpty()) {
+        if (i + 1 >= slices.size()) {
+            slices.resize(slices.size() + 1);
+        }
+        addDigitRecursive(slices, carry, i + 1);
+    }
+}
+
+// a year of daily counters over rows / 10 ids each, shifting through 10 id patterns
+auto dailyCounters(uint64_t rows) -> std::vector<roaring::Roaring64Bsi> {
+    constexpr size_t kDays = 365;
+    std::vector<roaring::Roaring64Bsi> days;
+    days.reserve(kDays);
+    for (size_t day = 0; day < kDays; day++) {
+        std::mt19937_64 rng(day);
+        std::uniform_int_distribution<uint64_t> dist(0, 1000);
+        std::vector<uint64_t> columnIds(rows / 10);
+        std::vector<uint64_t> values(rows / 10);
+        for (uint64_t i = 0; i < columnIds.size(); i++) {
+            columnIds[i] = i * 10 + day % 10;
+            values[i] = dist(rng);
+        }
+        days.emplace_back().setValuesSorted(columnIds, values);
+    }
+    return days;
+}
+
+void benchAdd(uint64_t rows) {
+    auto days = dailyCounters(rows);
+    fmt::print("add: {} daily counters of {} rows, iterative vs recursive carries\n", days.size(),
+               rows / 10);
+
+    uint64_t baselineSum = 0;
+    uint64_t candidateSum = 0;
+    double baseline = timeIt([&] {
+        std::vector<roaring::Roaring64Map> slices;
+        for (const auto& daily : days) {
+            if (slices.size() < daily.bitCount()) {
+                slices.resize(daily.bitCount());
+            }
+            for (size_t i = 0; i < daily.bitCount(); i++) {
+                addDigitRecursive(slices, daily.getSlice(i), i);
+            }
+        }
+        baselineSum = 0;
+        for (size_t i = 0; i < slices.size(); i++) {
+            baselineSum += (1UL << i) * slices[i].cardinality();
+        }
+    });
+    double candidate = timeIt([&] {
+        roaring::Roaring64Bsi total;
+        for (const auto& daily : days) {
+            total.add(daily);
+        }
+        candidateSum = std::get<0>(total.sum(nullptr));
+    });
+    if (baselineSum != candidateSum) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineSum, candidateSum);
+        std::exit(1);
+    }
+    report("yearly total", baseline, candidate);
+}
+
+void benchAddMany(uint64_t rows) {
+    auto days = dailyCounters(rows);
+    fmt::print("addMany: {} daily counters of {} rows, add loop vs carry-save\n", days.size(),
+               rows / 10);
+    std::vector<const roaring::Roaring64Bsi*> others;
+    for (const auto& daily : days) {
+        others.push_back(&daily);
+    }
+
+    uint64_t baselineSum = 0;
+    uint64_t candidateSum = 0;
+    double baseline = timeIt([&] {
+        roaring::Roaring64Bsi total;
+        for (const auto& daily : days) {
+            total.add(daily);
+        }
+        baselineSum = std::get<0>(total.sum(nullptr));
+    });
+    double candidate = timeIt([&] {
+        roaring::Roaring64Bsi total;
+        total.addMany(others);
+        candidateSum = std::get<0>(total.sum(nullptr));
+    });
+    if (baselineSum != candidateSum) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineSum, candidateSum);
+        std::exit(1);
+    }
+    report("yearly total", baseline, candidate);
+}
+
+void benchDeferMinMax(uint64_t rows) {
+    constexpr size_t kIncrements = 200;
+    fmt::print("add: {} increments of 100 rows into {} rows, eager vs deferred min/max\n",
+               kIncrements, rows);
+    auto base = buildBsi(rows, 1000);
+    std::vector<roaring::Roaring64Bsi> increments(kIncrements);
+    for (size_t i = 0; i < kIncrements; i++) {
+        for (uint64_t row = 0; row < 100; row++) {
+            increments[i].setValue((i * 7919 + row * 104729) % rows, 1);
+        }
+    }
+
+    auto run = [&](bool deferMinMax) {
+        roaring::Roaring64Bsi total = base;
+        total.setDeferMinMax(deferMinMax);
+        for (const auto& increment : increments) {
+            total.add(increment);
+        }
+        return total.countCompare(roaring::BsiOperation::GE, 500, 0, nullptr);
+    };
+    uint64_t baselineCount = 0;
+    uint64_t candidateCount = 0;
+    double baseline = timeIt([&] { baselineCount = run(false); });
+    double candidate = timeIt([&] { candidateCount = run(true); });
+    if (baselineCount != candidateCount) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineCount, candidateCount);
+        std::exit(1);
+    }
+    report("increments", baseline, candidate);
+}
+
+void benchFrameOfReference(uint64_t rows) {
+    constexpr uint64_t kEpoch = 1700000000000;
+    constexpr uint64_t kDayMs = 86400000;
+    fmt::print("one day of ms timestamps: absolute vs frame-of-reference slices ({} rows)\n", rows);
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> dist(kEpoch, kEpoch + kDayMs - 1);
+    std::vector<uint64_t> columnIds(rows);
+    std::vector<uint64_t> values(rows);
+    for (uint64_t i = 0; i < rows; i++) {
+        columnIds[i] = i;
+        values[i] = dist(rng);
+    }
+    roaring::Roaring64Bsi plain;
+    plain.setValuesSorted(columnIds, values);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValuesSorted(columnIds, values);
+    fmt::print("  slices {} vs {}, bytes {} vs {}\n", plain.bitCount(), offset.bitCount(),
+               plain.serializedSizeInBytes(), offset.serializedSizeInBytes());
+
+    const uint64_t start = kEpoch + kDayMs / 3;
+    const uint64_t end = kEpoch + kDayMs / 2;
+    uint64_t baselineCount = 0;
+    uint64_t candidateCount = 0;
+    double baseline =
+            timeIt([&] { baselineCount = plain.countCompare(roaring::RANGE, start, end); });
+    double candidate =
+            timeIt([&] { candidateCount = offset.countCompare(roaring::RANGE, start, end); });
+    if (baselineCount != candidateCount) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineCount, candidateCount);
+        std::exit(1);
+    }
+    report("RANGE count", baseline, candidate);
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < rows; i += 3) {
+        foundSet.add(i);
+    }
+    uint64_t baselineSum = 0;
+    uint64_t candidateSum = 0;
+    baseline = timeIt([&] { baselineSum = std::get<0>(plain.sum(&foundSet)); });
+    candidate = timeIt([&] { candidateSum = std::get<0>(offset.sum(&foundSet)); });
+    if (baselineSum != candidateSum) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineSum, candidateSum);
+        std::exit(1);
+    }
+    report("sum over a third", baseline, candidate);
+
+    // ever smaller timestamps, one setValue each: every one of them lowers the base
+    const uint64_t writes = std::min<uint64_t>(rows, 20000);
+    auto writeDescending = [&](roaring::Roaring64Bsi& bsi, bool frameOfReference) {
+        bsi = roaring::Roaring64Bsi();
+        bsi.setFrameOfReference(frameOfReference);
+        for (uint64_t i = 0; i < writes; i++) {
+            bsi.setValue(i, kEpoch - i * 1000);
+        }
+    };
+    roaring::Roaring64Bsi plainWrites;
+    roaring::Roaring64Bsi offsetWrites;
+    baseline = timeIt([&] { writeDescending(plainWrites, false); });
+    candidate = timeIt([&] { writeDescending(offsetWrites, true); });
+    if (plainWrites.sum(nullptr) != offsetWrites.sum(nullptr)) {
+        fmt::print("  result mismatch\n");
+        std::exit(1);
+    }
+    report(fmt::format("{} descending writes", writes), baseline, candidate);
+}
+
+void benchChunkZones(uint64_t rows) {
+    constexpr uint64_t kChunks = 64;
+    constexpr uint64_t kHourMs = 3600000;
+    fmt::print("time-ordered ids over {} chunks: without zones vs zone pruning ({} rows)\n",
+               kChunks, rows);
+    // ids are time-ordered: chunk c holds the timestamps of hour c
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<uint64_t> dist(0, kHourMs - 1);
+    std::vector<uint64_t> chunkedIds(rows);
+    std::vector<uint64_t> values(rows);
+    const uint64_t perChunk = rows / kChunks;
+    for (uint64_t i = 0; i < rows; i++) {
+        chunkedIds[i] = ((i / perChunk) << 32) | (i % perChunk);
+        values[i] = (i / perChunk) * kHourMs + dist(rng);
+    }
+    roaring::Roaring64Bsi chunked;
+    chunked.setValuesSorted(chunkedIds, values);
+
+    const uint64_t lastHours = (kChunks - 2) * kHourMs;
+    const uint64_t middle = kChunks / 2 * kHourMs;
+    // the bulk load fills the zones and writes keep them, so the query after a write prunes
+    chunked.setValue(chunkedIds[0], values[0] + 1);
+    auto start = std::chrono::steady_clock::now();
+    (void)chunked.countCompare(roaring::GE, middle, 0);
+    std::chrono::duration<double, std::milli> first = std::chrono::steady_clock::now() - start;
+    fmt::print("  first query after a write     {:>9.2f} ms\n", first.count());
+    // the same chunks read through deserializeLazy, which never prunes with zones
+    std::vector<char> buffer(chunked.indexedSizeInBytes());
+    chunked.serializeIndexed(buffer.data());
+    auto unzoned = roaring::Roaring64Bsi::deserializeLazy(buffer.data(), buffer.size());
+
+    const std::vector<std::tuple<std::string, roaring::BsiOperation, uint64_t, uint64_t>> queries {
+            {"GE last two hours", roaring::GE, lastHours, 0},
+            {"RANGE one hour", roaring::RANGE, middle + kHourMs / 2, middle + kHourMs * 3 / 2},
+    };
+    for (const auto& [name, operation, from, to] : queries) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline = timeIt(
+                [&] { baselineCard = unzoned->compare(operation, from, to)->cardinality(); });
+        double candidate = timeIt(
+                [&] { candidateCard = chunked.compare(operation, from, to)->cardinality(); });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(name, baseline, candidate);
+    }
+
+    uint64_t baselineCard = 0;
+    uint64_t candidateCard = 0;
+    double baseline = timeIt([&] { baselineCard = unzoned->topK(1000)->cardinality(); });
+    double candidate = timeIt([&] { candidateCard = chunked.topK(1000)->cardinality(); });
+    if (baselineCard != candidateCard) {
+        fmt::print("  result mismatch\n");
+        std::exit(1);
+    }
+    report("topK 1000", baseline, candidate);
+}
+
+void benchRangeEncoding(uint64_t rows) {
+    constexpr int kPredicates = 32;
+    fmt::print("range-encoded slices vs O'Neil, {} random predicates per op ({} rows)\n",
+               kPredicates, rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+    auto start = std::chrono::steady_clock::now();
+    auto rangeBsi = roaring::Roaring64RangeBsi::fromBsi(bsi);
+    std::chrono::duration<double, std::milli> convert = std::chrono::steady_clock::now() - start;
+    fmt::print("  conversion                    {:>9.2f} ms\n", convert.count());
+
+    std::mt19937_64 rng(13);
+    std::uniform_int_distribution<uint64_t> dist(0, UINT32_MAX);
+    std::vector<std::pair<uint64_t, uint64_t>> predicates;
+    for (int i = 0; i < kPredicates; i++) {
+        const uint64_t a = dist(rng);
+        const uint64_t b = dist(rng);
+        predicates.emplace_back(std::min(a, b), std::max(a, b));
+    }
+    for (auto operation : {roaring::LE, roaring::LT, roaring::GE, roaring::GT, roaring::RANGE}) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline = timeIt([&] {
+            baselineCard = 0;
+            for (const auto& [from, to] : predicates) {
+                baselineCard += bsi.compare(operation, from, to)->cardinality();
+            }
+        });
+        double candidate = timeIt([&] {
+            candidateCard = 0;
+            for (const auto& [from, to] : predicates) {
+                candidateCard += rangeBsi->compare(operation, from, to)->cardinality();
+            }
+        });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(opName(operation), baseline, candidate);
+    }
+}
+
+void benchEqIndex(uint64_t rows) {
+    constexpr uint64_t kDistinct = 20;
+    fmt::print("categorical column, {} values: BSI vs equality index ({} rows)\n", kDistinct,
+               rows);
+    // Zipf-like: value v is about twice as frequent as v + 1
+    std::mt19937_64 rng(5);
+    std::geometric_distribution<uint64_t> dist(0.5);
+    std::vector<std::tuple<uint64_t, uint64_t>> rowsVec;
+    rowsVec.reserve(rows);
+    for (uint64_t id = 0; id < rows; id++) {
+        rowsVec.emplace_back(id, std::min(dist(rng), kDistinct - 1) * 100);
+    }
+    roaring::Roaring64Bsi bsi;
+    bsi.setValues(rowsVec);
+    roaring::Roaring64EqIndex eqIndex;
+    eqIndex.setValues(rowsVec);
+
+    const std::vector<std::tuple<std::string, roaring::BsiOperation, uint64_t, uint64_t>> queries {
+            {"EQ frequent value", roaring::EQ, 0, 0},
+            {"EQ rare value", roaring::EQ, 1200, 0},
+            {"GE", roaring::GE, 300, 0},
+            {"RANGE", roaring::RANGE, 200, 600},
+    };
+    for (const auto& [name, operation, from, to] : queries) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline =
+                timeIt([&] { baselineCard = bsi.compare(operation, from, to)->cardinality(); });
+        double candidate = timeIt(
+                [&] { candidateCard = eqIndex.compare(operation, from, to)->cardinality(); });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(name, baseline, candidate);
+    }
+
+    // IN list: one EQ per value and their union on the BSI
+    const std::vector<uint64_t> in {100, 400, 700, 1100, 1500};
+    uint64_t baselineCard = 0;
+    uint64_t candidateCard = 0;
+    double baseline = timeIt([&] {
+        roaring::Roaring64Map matched;
+        for (auto value : in) {
+            matched |= *bsi.compare(roaring::EQ, value, 0);
+        }
+        baselineCard = matched.cardinality();
+    });
+    double candidate = timeIt([&] { candidateCard = eqIndex.compareIn(in)->cardinality(); });
+    if (baselineCard != candidateCard) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+        std::exit(1);
+    }
+    report("IN 5 values", baseline, candidate);
+}
+
+void benchCompareIn(uint64_t rows) {
+    fmt::print("IN list: OR of compare(EQ) vs compareIn trie ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, (1UL << 20) - 1);
+
+    std::mt19937_64 rng(17);
+    std::uniform_int_distribution<uint64_t> dist(0, (1UL << 20) - 1);
+    std::vector<uint64_t> scattered(500);
+    for (auto& value : scattered) {
+        value = dist(rng);
+    }
+    std::vector<uint64_t> consecutive(500);
+    std::iota(consecutive.begin(), consecutive.end(), 300000);
+    const std::vector<std::pair<std::string, const std::vector<uint64_t>*>> lists {
+            {"500 random values", &scattered},
+            {"500 consecutive values", &consecutive},
+    };
+    for (const auto& [name, values] : lists) {
+        uint64_t baselineCard = 0;
+        uint64_t candidateCard = 0;
+        double baseline = timeIt([&] {
+            roaring::Roaring64Map matched;
+            for (auto value : *values) {
+                matched |= *bsi.compare(roaring::EQ, value, 0);
+            }
+            baselineCard = matched.cardinality();
+        });
+        double candidate = timeIt([&] { candidateCard = bsi.compareIn(*values)->cardinality(); });
+        if (baselineCard != candidateCard) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineCard, candidateCard);
+            std::exit(1);
+        }
+        report(name, baseline, candidate);
+    }
+}
+
+void benchHistogram(uint64_t rows) {
+    constexpr uint64_t kBuckets = 50;
+    fmt::print("{}-bucket histogram: countCompare(LT) per boundary vs histogram ({} rows)\n",
+               kBuckets, rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+
+    std::vector<uint64_t> boundaries;
+    for (uint64_t b = 1; b < kBuckets; b++) {
+        boundaries.push_back(UINT32_MAX / kBuckets * b);
+    }
+    std::vector<uint64_t> baselineCounts;
+    std::vector<uint64_t> candidateCounts;
+    double baseline = timeIt([&] {
+        baselineCounts.clear();
+        uint64_t below = 0;
+        for (auto boundary : boundaries) {
+            uint64_t lt = bsi.countCompare(roaring::LT, boundary, 0);
+            baselineCounts.push_back(lt - below);
+            below = lt;
+        }
+        baselineCounts.push_back(bsi.getExistenceBitmap().cardinality() - below);
+    });
+    double candidate = timeIt([&] { candidateCounts = bsi.histogram(boundaries); });
+    if (baselineCounts != candidateCounts) {
+        fmt::print("  result mismatch\n");
+        std::exit(1);
+    }
+    report("equal-width buckets", baseline, candidate);
+}
+
+void benchQuantile(uint64_t rows) {
+    fmt::print("p50/p99/p999: getValues + nth_element vs quantile ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+
+    const std::vector<double> qs {0.5, 0.99, 0.999};
+    std::vector<uint64_t> baselineValues;
+    std::vector<uint64_t> candidateValues;
+    double baseline = timeIt([&] {
+        baselineValues.clear();
+        auto values = bsi.getValues(bsi.getExistenceBitmap());
+        for (double q : qs) {
+            auto rank = static_cast<uint64_t>(std::ceil(q * values.size())) - 1;
+            std::nth_element(values.begin(), values.begin() + rank, values.end());
+            baselineValues.push_back(values[rank]);
+        }
+    });
+    double candidate = timeIt([&] {
+        candidateValues.clear();
+        for (double q : qs) {
+            candidateValues.push_back(std::get<0>(bsi.quantile(q)));
+        }
+    });
+    if (baselineValues != candidateValues) {
+        fmt::print("  result mismatch\n");
+        std::exit(1);
+    }
+    report("3 quantiles", baseline, candidate);
+}
+
+void benchMinMax(uint64_t rows) {
+    fmt::print("filtered argMax: getValues + scan vs argMax ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+
+    std::mt19937_64 rng(23);
+    std::uniform_int_distribution<uint64_t> dist(0, rows - 1);
+    std::vector<uint64_t> ids(rows / 10);
+    for (auto& id : ids) {
+        id = dist(rng);
+    }
+    roaring::Roaring64Map segment;
+    segment.addMany(ids.size(), ids.data());
+    const std::vector<std::pair<std::string, const roaring::Roaring64Map*>> sets {
+            {"all rows", &bsi.getExistenceBitmap()},
+            {"10% random segment", &segment},
+    };
+    for (const auto& [name, foundSet] : sets) {
+        roaring::Roaring64Map baselineRows;
+        roaring::Roaring64Map candidateRows;
+        uint64_t baselineValue = 0;
+        uint64_t candidateValue = 0;
+        double baseline = timeIt([&] {
+            auto candidates = bsi.getExistenceBitmap() & *foundSet;
+            auto values = bsi.getValues(candidates);
+            baselineValue = *std::max_element(values.begin(), values.end());
+            baselineRows = roaring::Roaring64Map();
+            size_t r = 0;
+            for (auto columnId : candidates) {
+                if (values[r++] == baselineValue) {
+                    baselineRows.add(columnId);
+                }
+            }
+        });
+        double candidate = timeIt([&] {
+            auto [value, maxRows] = bsi.argMax(foundSet);
+            candidateValue = value;
+            candidateRows = std::move(*maxRows);
+        });
+        if (baselineValue != candidateValue || baselineRows != candidateRows) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineValue, candidateValue);
+            std::exit(1);
+        }
+        report(name, baseline, candidate);
+    }
+}
+
+// the topK loop that materialized the candidates with each slice before counting them
+auto materializingTopK(const roaring::Roaring64Bsi& bsi, uint64_t k,
+                       const roaring::Roaring64Map& foundSet) -> roaring::Roaring64Map {
+    roaring::Roaring64Map candidates = bsi.getExistenceBitmap() & foundSet;
+    roaring::Roaring64Map selected;
+    const uint64_t target = k;
+    for (int32_t x = bsi.bitCount() - 1; x >= 0 && !candidates.isEmpty() && k > 0; x--) {
+        roaring::Roaring64Map ones = candidates;
+        ones &= bsi.getSlice(x);
+        const uint64_t cardinality = ones.cardinality();
+        if (cardinality > k) {
+            candidates &= bsi.getSlice(x);
+        } else {
+            selected |= ones;
+            candidates -= bsi.getSlice(x);
+            k -= cardinality;
+        }
+    }
+    uint64_t needed = target - selected.cardinality();
+    for (auto it = candidates.begin(); needed > 0 && it != candidates.end(); ++it, needed--) {
+        selected.add(*it);
+    }
+    return selected;
+}
+
+void benchNonMaterializing(uint64_t rows) {
+    fmt::print("sum / topK over a foundSet: materialized intersections vs and_cardinality "
+               "({} rows)\n",
+               rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+    roaring::Roaring64Map foundSet;
+    foundSet.addRange(0, rows / 2);
+
+    uint64_t baselineSum = 0;
+    uint64_t candidateSum = 0;
+    double baseline = timeIt([&] {
+        baselineSum = 0;
+        for (size_t i = 0; i < bsi.bitCount(); i++) {
+            baselineSum += (1UL << i) * (bsi.getSlice(i) & foundSet).cardinality();
+        }
+    });
+    double candidate = timeIt([&] { candidateSum = std::get<0>(bsi.sum(&foundSet)); });
+    if (baselineSum != candidateSum) {
+        fmt::print("  result mismatch: {} vs {}\n", baselineSum, candidateSum);
+        std::exit(1);
+    }
+    report("sum", baseline, candidate);
+
+    roaring::Roaring64Map baselineRows;
+    roaring::Roaring64Map candidateRows;
+    baseline = timeIt([&] { baselineRows = materializingTopK(bsi, 1000, foundSet); });
+    candidate = timeIt([&] { candidateRows = std::move(*bsi.topK(1000, &foundSet)); });
+    if (baselineRows != candidateRows) {
+        fmt::print("  result mismatch\n");
+        std::exit(1);
+    }
+    report("topK 1000", baseline, candidate);
+}
+
+void benchSumOfSquares(uint64_t rows) {
+    fmt::print("variance over a foundSet: getValues + two passes vs variance ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT16_MAX);
+    roaring::Roaring64Map foundSet;
+    for (uint64_t id = 0; id < rows; id += 2) {
+        foundSet.add(id);
+    }
+
+    for (size_t threads : {size_t {1}, size_t {4}}) {
+        bsi.setThreadPool(threads > 1 ? std::make_shared<roaring::ThreadPool>(threads) : nullptr);
+        double baselineVariance = 0;
+        double candidateVariance = 0;
+        double baseline = timeIt([&] {
+            auto values = bsi.getValues(bsi.getExistenceBitmap() & foundSet);
+            long double mean = 0;
+            for (auto value : values) {
+                mean += value;
+            }
+            mean /= values.size();
+            long double squares = 0;
+            for (auto value : values) {
+                squares += (value - mean) * (value - mean);
+            }
+            baselineVariance = static_cast<double>(squares / values.size());
+        });
+        double candidate =
+                timeIt([&] { candidateVariance = std::get<0>(bsi.variance(&foundSet)); });
+        if (std::abs(baselineVariance - candidateVariance) > baselineVariance * 1e-9) {
+            fmt::print("  result mismatch: {} vs {}\n", baselineVariance, candidateVariance);
+            std::exit(1);
+        }
+        report(fmt::format("{} thread(s)", threads), baseline, candidate);
+    }
+}
+
+void benchGroupSum(uint64_t rows) {
+    fmt::print("group sums: sum() per group vs groupSum ({} rows)\n", rows);
+    auto bsi = buildBsi(rows, UINT32_MAX);
+
+    for (size_t groupCount : {size_t {50}, size_t {500}, size_t {5000}}) {
+        std::mt19937_64 rng(29);
+        std::uniform_int_distribution<size_t> dist(0, groupCount - 1);
+        std::vector<std::vector<uint64_t>> members(groupCount);
+        for (uint64_t id = 0; id < rows; id++) {
+            members[dist(rng)].push_back(id);
+        }
+        std::vector<roaring::Roaring64Map> groupSets(groupCount);
+        std::vector<const roaring::Roaring64Map*> groups;
+        for (size_t g = 0; g < groupCount; g++) {
+            groupSets[g].addMany(members[g].size(), members[g].data());
+            groups.push_back(&groupSets[g]);
+        }
+
+        std::vector<std::tuple<unsigned __int128, uint64_t>> baselineSums;
+        std::vector<std::tuple<unsigned __int128, uint64_t>> candidateSums;
+        double baseline = timeIt([&] {
+            baselineSums.clear();
+            for (const auto* group : groups) {
+                baselineSums.push_back(bsi.sum(group));
+            }
+        });
+        double candidate = timeIt([&] { candidateSums = bsi.groupSum(groups); });
+        if (baselineSums != candidateSums) {
+            fmt::print("  result mismatch\n");
+            std::exit(1);
+        }
+        report(fmt::format("{} random groups", groupCount), baseline, candidate);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    uint64_t rows = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : kDefaultRows;
+
+    benchCompareKernels(rows);
+    benchRange(rows);
+    benchFoundSetPushDown(rows);
+    benchCountCompare(rows);
+    benchParallelScaling(rows);
+    benchBulkLoad(rows);
+    benchDecode(rows);
+    benchTransposeWithCount(rows);
+    benchFrozenOpen(rows);
+    benchLazyOpen(rows);
+    benchFilter(rows);
+    benchAdd(rows);
+    benchAddMany(rows);
+    benchDeferMinMax(rows);
+    benchFrameOfReference(rows);
+    benchChunkZones(rows);
+    benchRangeEncoding(rows);
+    benchEqIndex(rows);
+    benchCompareIn(rows);
+    benchHistogram(rows);
+    benchQuantile(rows);
+    benchMinMax(rows);
+    benchNonMaterializing(rows);
+    benchSumOfSquares(rows);
+    benchGroupSum(rows);
+
+    return 0;
+}
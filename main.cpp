@@ -1,6 +1,10 @@
+#include <bit>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
+#include <filesystem>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <optional>
 #include <ranges>
@@ -8,7 +12,11 @@
 #include <vector>
 
 #include "roaring.hh"      // the amalgamated roaring.hh includes roaring64map.hh
+#include "roaring64adaptiveindex.hh"
 #include "roaring64bsi.hh" // the amalgamated roaring.hh includes roaring64map.hh
+#include "roaring64bsiview.hh"
+#include "roaring64eqindex.hh"
+#include "roaring64rangebsi.hh"
 
 //测试代码参考java实现：https://github.com/RoaringBitmap/RoaringBitmap/blob/master/bsi/src/test/java/org/roaringbitmap/bsi/R64BSITest.java
 
@@ -552,6 +560,1497 @@ void testIssue755() {
     assert(std::get<0>(bsi.getValue(2L)) == (long)INT32_MAX + 23456);     // {-2147460193,true}
 }
 
+// check every compare operation against a brute-force scan
+void testCompareAgainstScan() {
+    std::cout << "testCompareAgainstScan" << std::endl;
+
+    roaring::Roaring64Bsi bsi;
+    std::vector<uint64_t> values(1000);
+    for (uint64_t i = 0; i < values.size(); i++) {
+        values[i] = (i * 7919) % 613;
+        bsi.setValue(i, values[i]);
+    }
+
+    // a selective foundSet is pushed down into the scan, a wide one is applied at the end
+    roaring::Roaring64Map foundSet;
+    roaring::Roaring64Map wideFoundSet;
+    for (uint64_t i = 0; i < values.size(); i++) {
+        if (i % 3 == 0) {
+            foundSet.add(i);
+        }
+        if (i % 10 != 0) {
+            wideFoundSet.add(i);
+        }
+    }
+    // ids without a value never match, not even NEQ
+    wideFoundSet.addRange(values.size(), values.size() + 500);
+
+    auto matches = [](roaring::BsiOperation op, uint64_t v, uint64_t start, uint64_t end) {
+        switch (op) {
+        case roaring::EQ:
+            return v == start;
+        case roaring::NEQ:
+            return v != start;
+        case roaring::LE:
+            return v <= start;
+        case roaring::LT:
+            return v < start;
+        case roaring::GE:
+            return v >= start;
+        case roaring::GT:
+            return v > start;
+        case roaring::RANGE:
+            return v >= start && v <= end;
+        default:
+            return false;
+        }
+    };
+
+    for (auto op : {roaring::EQ, roaring::NEQ, roaring::LE, roaring::LT, roaring::GE, roaring::GT,
+                    roaring::RANGE}) {
+        for (uint64_t start : {0UL, 1UL, 63UL, 64UL, 255UL, 256UL, 300UL, 511UL, 612UL, 1000UL}) {
+            uint64_t end = start + 97;
+            for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                                   (const roaring::Roaring64Map*)&foundSet,
+                                                   (const roaring::Roaring64Map*)&wideFoundSet}) {
+                roaring::Roaring64Map expected;
+                for (uint64_t i = 0; i < values.size(); i++) {
+                    if ((f == nullptr || f->contains(i)) && matches(op, values[i], start, end)) {
+                        expected.add(i);
+                    }
+                }
+                auto result = bsi.compare(op, start, end, f);
+                assert(result);
+                assert(*result == expected);
+                assert(bsi.countCompare(op, start, end, f) == expected.cardinality());
+            }
+        }
+    }
+}
+
+void testParallel() {
+    std::cout << "testParallel" << std::endl;
+
+    // spread the ids over many high-key chunks
+    roaring::Roaring64Bsi serial;
+    for (uint64_t i = 0; i < 5000; i++) {
+        serial.setValue(((i % 37) << 32) | i, (i * 7919) % 1021);
+    }
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 5000; i += 3) {
+        foundSet.add(((i % 37) << 32) | i);
+    }
+
+    roaring::Roaring64Bsi parallel = serial;
+    parallel.setThreadPool(std::make_shared<roaring::ThreadPool>(4));
+
+    for (auto op : {roaring::EQ, roaring::NEQ, roaring::LE, roaring::LT, roaring::GE, roaring::GT,
+                    roaring::RANGE}) {
+        for (uint64_t start : {0UL, 17UL, 512UL, 1000UL}) {
+            assert(*parallel.compare(op, start, start + 200) ==
+                   *serial.compare(op, start, start + 200));
+            assert(*parallel.compare(op, start, start + 200, &foundSet) ==
+                   *serial.compare(op, start, start + 200, &foundSet));
+            assert(parallel.countCompare(op, start, start + 200, &foundSet) ==
+                   serial.countCompare(op, start, start + 200, &foundSet));
+        }
+    }
+
+    assert(parallel.sum(&foundSet) == serial.sum(&foundSet));
+    assert(parallel.sum(nullptr) == serial.sum(nullptr));
+    for (uint64_t k : {1UL, 10UL, 333UL, 4999UL, 6000UL}) {
+        assert(*parallel.topK(k) == *serial.topK(k));
+        assert(*parallel.topK(k, &foundSet) == *serial.topK(k, &foundSet));
+    }
+    assert(parallel.filter(&foundSet)->sum(nullptr) == serial.filter(&foundSet)->sum(nullptr));
+    assert(parallel.exclude(&foundSet)->sum(nullptr) == serial.exclude(&foundSet)->sum(nullptr));
+}
+
+void testBulkLoad() {
+    std::cout << "testBulkLoad" << std::endl;
+
+    auto sameValues = [](const roaring::Roaring64Bsi& left, const roaring::Roaring64Bsi& right) {
+        assert(left.getExistenceBitmap() == right.getExistenceBitmap());
+        assert(left.bitCount() == right.bitCount());
+        for (uint64_t columnId : left.getExistenceBitmap()) {
+            assert(left.getValue(columnId) == right.getValue(columnId));
+        }
+    };
+
+    // sorted ids over several high-key chunks, values of varying depth
+    std::vector<uint64_t> columnIds;
+    std::vector<uint64_t> values;
+    roaring::Roaring64Bsi expected;
+    for (uint64_t i = 0; i < 3000; i++) {
+        uint64_t columnId = ((i / 1000) << 32) | (i * 3);
+        uint64_t value = (i * 0x9E3779B97F4A7C15ULL) >> (i % 64);
+        columnIds.push_back(columnId);
+        values.push_back(value);
+        expected.setValue(columnId, value);
+    }
+    roaring::Roaring64Bsi bulk;
+    assert(bulk.setValuesSorted(columnIds, values));
+    sameValues(bulk, expected);
+
+    // overwrite part of a loaded index and extend both ends of its value range
+    std::vector<uint64_t> updateIds;
+    std::vector<uint64_t> updateValues;
+    for (uint64_t i = 0; i < 4000; i += 7) {
+        uint64_t columnId = ((i / 1000) << 32) | (i * 3);
+        updateIds.push_back(columnId);
+        updateValues.push_back(i == 0 ? 0 : i * 11);
+        expected.setValue(columnId, updateValues.back());
+    }
+    assert(bulk.setValuesSorted(updateIds, updateValues));
+    sameValues(bulk, expected);
+
+    // unsorted input with duplicates: the last row for an id wins
+    roaring::Roaring64Bsi unsorted;
+    unsorted.setValues({{9, 1}, {3, 2}, {9, 300}, {1UL << 40, 5}, {3, 4}});
+    assert(unsorted.getValue(9) == std::make_tuple(300UL, true));
+    assert(unsorted.getValue(3) == std::make_tuple(4UL, true));
+    assert(unsorted.getValue(1UL << 40) == std::make_tuple(5UL, true));
+    assert(unsorted.getExistenceBitmap().cardinality() == 3);
+
+    // rejected input leaves the index untouched
+    std::vector<uint64_t> descending {5, 4};
+    std::vector<uint64_t> two {1, 2};
+    std::vector<uint64_t> one {1};
+    assert(!unsorted.setValuesSorted(descending, two));
+    assert(!unsorted.setValuesSorted(two, one));
+    assert(unsorted.getExistenceBitmap().cardinality() == 3);
+}
+
+void testGetValues() {
+    std::cout << "testGetValues" << std::endl;
+
+    roaring::Roaring64Bsi bsi;
+    for (uint64_t i = 0; i < 3000; i++) {
+        bsi.setValue(((i % 5) << 32) | (i * 13), (i * 0x9E3779B97F4A7C15ULL) >> (i % 64));
+    }
+
+    // ids over several chunks, some of them without a value
+    roaring::Roaring64Map ids;
+    for (uint64_t i = 0; i < 4000; i += 3) {
+        ids.add(((i % 5) << 32) | (i * 13));
+        ids.add((7UL << 32) | i);
+    }
+    auto values = bsi.getValues(ids);
+    assert(values.size() == ids.cardinality());
+    size_t i = 0;
+    for (uint64_t columnId : ids) {
+        assert(values[i++] == std::get<0>(bsi.getValue(columnId)));
+    }
+
+    std::vector<uint64_t> all(bsi.getExistenceBitmap().cardinality());
+    assert(bsi.decodeAll(all) == all.size());
+    i = 0;
+    for (uint64_t columnId : bsi.getExistenceBitmap()) {
+        assert(all[i++] == std::get<0>(bsi.getValue(columnId)));
+    }
+    std::vector<uint64_t> tooSmall(all.size() - 1);
+    assert(bsi.decodeAll(tooSmall) == 0);
+
+    bsi.setThreadPool(std::make_shared<roaring::ThreadPool>(4));
+    assert(bsi.getValues(ids) == values);
+    assert(bsi.getValues(roaring::Roaring64Map()).empty());
+}
+
+void testTransposeWithCountEngines() {
+    std::cout << "testTransposeWithCountEngines" << std::endl;
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 5000; i += 4) {
+        foundSet.add(i);
+    }
+    // a shallow column is counted by partitioning, a deep one by sorting
+    for (uint64_t modulus : {200UL, 1UL << 20}) {
+        roaring::Roaring64Bsi bsi;
+        std::map<uint64_t, uint64_t> all;
+        std::map<uint64_t, uint64_t> found;
+        for (uint64_t i = 0; i < 5000; i++) {
+            uint64_t value = (i * i * 7919) % modulus;
+            bsi.setValue(i, value);
+            all[value]++;
+            if (foundSet.contains(i)) {
+                found[value]++;
+            }
+        }
+        auto check = [&bsi](const roaring::Roaring64Map* set,
+                            const std::map<uint64_t, uint64_t>& expected) {
+            auto histogram = bsi.transposeWithCount(set);
+            assert(histogram->getExistenceBitmap().cardinality() == expected.size());
+            for (const auto& [value, count] : expected) {
+                assert(histogram->getValue(value) == std::make_tuple(count, true));
+            }
+        };
+        check(nullptr, all);
+        check(&foundSet, found);
+    }
+
+    roaring::Roaring64Bsi empty;
+    assert(empty.transposeWithCount()->getExistenceBitmap().isEmpty());
+}
+
+void testFrozenView() {
+    std::cout << "testFrozenView" << std::endl;
+
+    roaring::Roaring64Bsi bsi;
+    for (uint64_t i = 0; i < 5000; i++) {
+        bsi.setValue(((i % 3) << 32) | (i * 7), (i * 7919) % 100003);
+    }
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 5000; i += 5) {
+        foundSet.add(((i % 3) << 32) | (i * 7));
+    }
+
+    auto path = (std::filesystem::temp_directory_path() / "bsi_frozen_view_test.bsi").string();
+    [[maybe_unused]] const bool written = roaring::Roaring64BsiView::write(bsi, path);
+    assert(written);
+    auto view = roaring::Roaring64BsiView::open(path);
+    assert(view != nullptr);
+
+    assert((*view)->getExistenceBitmap() == bsi.getExistenceBitmap());
+    assert((*view)->bitCount() == bsi.bitCount());
+    for (auto op : {roaring::EQ, roaring::NEQ, roaring::LE, roaring::GT, roaring::RANGE}) {
+        assert(*(*view)->compare(op, 500, 70000, &foundSet) ==
+               *bsi.compare(op, 500, 70000, &foundSet));
+    }
+    assert((*view)->sum(&foundSet) == bsi.sum(&foundSet));
+    assert(*(*view)->topK(100) == *bsi.topK(100));
+    assert((*view)->getValues(foundSet) == bsi.getValues(foundSet));
+
+    // a view can be copied into a regular, writable index
+    roaring::Roaring64Bsi copy = **view;
+    copy.setValue(1, 1);
+    assert(copy.getValue(1) == std::make_tuple(1UL, true));
+    view.reset();
+    std::filesystem::remove(path);
+
+    // malformed input is rejected
+    alignas(32) char garbage[64] = {};
+    assert(roaring::Roaring64Bsi::frozenView(garbage, sizeof(garbage)) == nullptr);
+    assert(roaring::Roaring64BsiView::open(path) == nullptr);
+}
+
+void testIndexedLazy() {
+    std::cout << "testIndexedLazy" << std::endl;
+
+    roaring::Roaring64Bsi bsi;
+    for (uint64_t i = 0; i < 5000; i++) {
+        bsi.setValue(((i % 3) << 32) | (i * 7), (i * 7919) % 100003);
+    }
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 5000; i += 5) {
+        foundSet.add(((i % 3) << 32) | (i * 7));
+    }
+
+    std::vector<char> buffer(bsi.indexedSizeInBytes());
+    [[maybe_unused]] const size_t written = bsi.serializeIndexed(buffer.data());
+    assert(written == buffer.size());
+
+    auto lazy = roaring::Roaring64Bsi::deserializeLazy(buffer.data(), buffer.size());
+    assert(lazy != nullptr);
+    assert(lazy->bitCount() == bsi.bitCount());
+    for (size_t i = 0; i < bsi.bitCount(); i++) {
+        assert(lazy->getSliceCardinality(i) == bsi.getSlice(i).cardinality());
+    }
+    assert(lazy->sum(nullptr) == bsi.sum(nullptr));
+    for (auto op : {roaring::EQ, roaring::NEQ, roaring::LT, roaring::GE, roaring::RANGE}) {
+        assert(*lazy->compare(op, 500, 70000, &foundSet) ==
+               *bsi.compare(op, 500, 70000, &foundSet));
+    }
+    assert(lazy->sum(&foundSet) == bsi.sum(&foundSet));
+    assert(*lazy->topK(100) == *bsi.topK(100));
+
+    // copies share the unparsed slices; modifying one parses them into that copy only
+    roaring::Roaring64Bsi copy = *lazy;
+    copy.setValue(1, 123456789);
+    assert(copy.getValue(1) == std::make_tuple(123456789UL, true));
+    assert(!std::get<1>(lazy->getValue(1)));
+    assert(lazy->getValues(foundSet) == bsi.getValues(foundSet));
+
+    // the legacy layout round-trips from a lazy index too
+    std::unique_ptr<char[]> legacy;
+    lazy->serializeBuffer(legacy);
+    roaring::Roaring64Bsi restored;
+    restored.deserialize(legacy.get());
+    assert(restored.getValues(foundSet) == bsi.getValues(foundSet));
+
+    // wrong magic, version or truncated directory
+    assert(roaring::Roaring64Bsi::deserializeLazy(legacy.get(), 40) == nullptr);
+    buffer[8] = 3;
+    assert(roaring::Roaring64Bsi::deserializeLazy(buffer.data(), buffer.size()) == nullptr);
+    buffer[8] = 1;
+    assert(roaring::Roaring64Bsi::deserializeLazy(buffer.data(), 48) == nullptr);
+}
+
+void testCopyOnWrite() {
+    std::cout << "testCopyOnWrite" << std::endl;
+
+    roaring::Roaring64Bsi bsi;
+    for (uint64_t i = 0; i < 3000; i++) {
+        bsi.setValue(((i % 4) << 32) | i, (i * 7919) % 4099);
+    }
+    // only touches two of the four chunks
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 3000; i += 2) {
+        foundSet.add(((i % 4) << 32) | i);
+    }
+
+    for (bool copyOnWrite : {false, true}) {
+        bsi.setCopyOnWrite(copyOnWrite);
+        auto filtered = bsi.filter(&foundSet);
+        auto excluded = bsi.exclude(&foundSet);
+        assert(filtered->getExistenceBitmap() == (bsi.getExistenceBitmap() & foundSet));
+        assert(excluded->getExistenceBitmap() == (bsi.getExistenceBitmap() - foundSet));
+        for (uint64_t columnId : bsi.getExistenceBitmap()) {
+            auto value = bsi.getValue(columnId);
+            auto& part = foundSet.contains(columnId) ? filtered : excluded;
+            assert(part->getValue(columnId) == value);
+        }
+
+        // writes to a copy never show through to the original
+        auto copy = bsi.clone();
+        copy->setValue(4, 100000);
+        excluded->setValue((1UL << 32) | 1, 100000);
+        assert(bsi.getValue(4) == std::make_tuple(uint64_t {(4 * 7919) % 4099}, true));
+        assert(bsi.getValue((1UL << 32) | 1) == std::make_tuple(uint64_t {7919 % 4099}, true));
+        assert(copy->getValue(4) == std::make_tuple(100000UL, true));
+    }
+
+    // queries that mix the slices of a copy-on-write index with a plain foundSet
+    roaring::Roaring64Bsi reference = bsi;
+    reference.setCopyOnWrite(false);
+    bsi.setCopyOnWrite(true);
+    for (auto op : {roaring::EQ, roaring::NEQ, roaring::LE, roaring::GT, roaring::RANGE}) {
+        assert(*bsi.compare(op, 500, 3000, &foundSet) ==
+               *reference.compare(op, 500, 3000, &foundSet));
+        assert(bsi.countCompare(op, 500, 3000, &foundSet) ==
+               reference.countCompare(op, 500, 3000, &foundSet));
+    }
+    assert(bsi.sum(&foundSet) == reference.sum(&foundSet));
+
+    // both a copy-on-write index and its clone freeze into valid views
+    auto clone = bsi.clone();
+    for (const auto* index : {&bsi, clone.get()}) {
+        const size_t size = index->frozenSizeInBytes();
+        std::vector<char> buffer(size + 32);
+        char* aligned = buffer.data() + (32 - reinterpret_cast<uintptr_t>(buffer.data()) % 32) % 32;
+        [[maybe_unused]] const size_t written = index->writeFrozen(aligned);
+        assert(written == size);
+        auto view = roaring::Roaring64Bsi::frozenView(aligned, size);
+        assert(view != nullptr);
+        assert(*view->compare(roaring::RANGE, 500, 3000, &foundSet) ==
+               *reference.compare(roaring::RANGE, 500, 3000, &foundSet));
+        assert(view->getValues(foundSet) == reference.getValues(foundSet));
+    }
+    clone->setValue(4, 7);
+    assert(bsi.getValue(4) == reference.getValue(4));
+    assert(clone->getValue(4) == std::make_tuple(7UL, true));
+}
+
+void testAddRippleCarry() {
+    std::cout << "testAddRippleCarry" << std::endl;
+
+    // daily counters of varying depth over partly overlapping ids and several chunks
+    roaring::Roaring64Bsi total;
+    std::map<uint64_t, uint64_t> expected;
+    for (uint64_t day = 0; day < 40; day++) {
+        roaring::Roaring64Bsi daily;
+        for (uint64_t i = day * 10; i < day * 10 + 300; i++) {
+            uint64_t columnId = ((i % 3) << 32) | i;
+            uint64_t value = (i * 7919 + day) % (day % 2 == 0 ? 7 : 100003);
+            daily.setValue(columnId, value);
+            expected[columnId] += value;
+        }
+        total.add(daily);
+    }
+    // all-ones plus one carries into a new top slice
+    roaring::Roaring64Bsi ones;
+    ones.setValue(1, 0xFFFF);
+    roaring::Roaring64Bsi one;
+    one.setValue(1, 1);
+    ones.add(one);
+    assert(ones.getValue(1) == std::make_tuple(0x10000UL, true));
+    assert(ones.bitCount() == 17);
+
+    assert(total.getExistenceBitmap().cardinality() == expected.size());
+    for (const auto& [columnId, value] : expected) {
+        assert(total.getValue(columnId) == std::make_tuple(value, true));
+    }
+    uint64_t maxValue = 0;
+    for (const auto& [columnId, value] : expected) {
+        maxValue = std::max(maxValue, value);
+    }
+    assert(total.bitCount() == std::bit_width(maxValue));
+}
+
+void testAddMany() {
+    std::cout << "testAddMany" << std::endl;
+
+    std::vector<std::unique_ptr<roaring::Roaring64Bsi>> dailies;
+    std::map<uint64_t, uint64_t> expected;
+    for (uint64_t day = 0; day < 30; day++) {
+        auto daily = std::make_unique<roaring::Roaring64Bsi>();
+        for (uint64_t i = day * 7; i < day * 7 + 200; i++) {
+            uint64_t columnId = ((i % 3) << 32) | i;
+            uint64_t value = (i * 104729 + day) % (day % 3 == 0 ? 3 : 65537);
+            daily->setValue(columnId, value);
+            expected[columnId] += value;
+        }
+        dailies.push_back(std::move(daily));
+    }
+
+    // start from a non-empty index, and skip nullptr and empty inputs
+    roaring::Roaring64Bsi total;
+    total.setValue(5, 1000);
+    expected[5] += 1000;
+    roaring::Roaring64Bsi empty;
+    std::vector<const roaring::Roaring64Bsi*> others {nullptr, &empty};
+    for (const auto& daily : dailies) {
+        others.push_back(daily.get());
+    }
+    total.addMany(others);
+
+    roaring::Roaring64Bsi sequential;
+    sequential.setValue(5, 1000);
+    for (const auto& daily : dailies) {
+        sequential.add(*daily);
+    }
+
+    assert(total.getExistenceBitmap() == sequential.getExistenceBitmap());
+    assert(total.bitCount() == sequential.bitCount());
+    assert(total.getExistenceBitmap().cardinality() == expected.size());
+    for (const auto& [columnId, value] : expected) {
+        assert(total.getValue(columnId) == std::make_tuple(value, true));
+    }
+    assert(total.compare(roaring::BsiOperation::RANGE, 0, UINT64_MAX)->cardinality() ==
+           expected.size());
+
+    // nothing to add leaves the index untouched
+    roaring::Roaring64Bsi ones;
+    ones.setValue(1, 0xFF);
+    ones.addMany(std::vector<const roaring::Roaring64Bsi*> {nullptr, &empty});
+    assert(ones.getValue(1) == std::make_tuple(0xFFUL, true));
+    assert(ones.bitCount() == 8);
+
+    // the index itself among the operands is added as it was before the call
+    roaring::Roaring64Bsi self;
+    self.setValue(1, 6);
+    self.setValue(uint64_t {2} << 32, 3);
+    roaring::Roaring64Bsi doubled = self;
+    doubled.add(self);
+    roaring::Roaring64Bsi aliased = self;
+    aliased.addMany(std::vector<const roaring::Roaring64Bsi*> {&aliased});
+    assert(aliased.getValue(1) == std::make_tuple(12UL, true));
+    assert(aliased.getExistenceBitmap() == doubled.getExistenceBitmap());
+    assert(aliased.getValue(uint64_t {2} << 32) == doubled.getValue(uint64_t {2} << 32));
+    roaring::Roaring64Bsi tripled = self;
+    tripled.addMany(std::vector<const roaring::Roaring64Bsi*> {&tripled, &ones, &tripled});
+    assert(tripled.getValue(1) == std::make_tuple(18UL + 0xFF, true));
+    assert(tripled.getValue(uint64_t {2} << 32) == std::make_tuple(9UL, true));
+
+    // the same holds when frame-of-reference sends addMany through add()
+    for (bool frameOfReference : {false, true}) {
+        roaring::Roaring64Bsi index;
+        index.setFrameOfReference(frameOfReference);
+        index.setValue(1, 103);
+        index.setValue(2, 101);
+        roaring::Roaring64Bsi other;
+        other.setValue(1, 5);
+        other.setValue(3, 2);
+        index.addMany(std::vector<const roaring::Roaring64Bsi*> {&other, &index});
+        assert(index.getValue(1) == std::make_tuple(211UL, true));
+        assert(index.getValue(2) == std::make_tuple(202UL, true));
+        assert(index.getValue(3) == std::make_tuple(2UL, true));
+    }
+}
+
+void testMinMaxMaintenance() {
+    std::cout << "testMinMaxMaintenance" << std::endl;
+
+    auto bounds = [](const roaring::Roaring64Bsi& bsi) {
+        return bsi.toString().substr(0, bsi.toString().find(", runOptimized"));
+    };
+
+    // disjoint rows: min/max are taken from the operands
+    roaring::Roaring64Bsi total;
+    total.setValue(1, 50);
+    total.setValue(2, 70);
+    roaring::Roaring64Bsi disjoint;
+    disjoint.setValue((1UL << 32) | 3, 20);
+    disjoint.setValue(4, 900);
+    total.add(disjoint);
+    assert(bounds(total) == "Roaring64Bsi: minValue 20, maxValue 900");
+
+    // overlapping rows: rescanned in one pass
+    roaring::Roaring64Bsi overlap;
+    overlap.setValue(1, 1000);
+    overlap.setValue((1UL << 32) | 3, 5);
+    total.add(overlap);
+    assert(bounds(total) == "Roaring64Bsi: minValue 25, maxValue 1050");
+
+    // deferred: stale until a reader needs min/max, then exact
+    roaring::Roaring64Bsi deferred;
+    deferred.setDeferMinMax(true);
+    std::map<uint64_t, uint64_t> expected;
+    for (uint64_t day = 0; day < 20; day++) {
+        roaring::Roaring64Bsi daily;
+        for (uint64_t i = day; i < day + 50; i++) {
+            daily.setValue(i, i % 7 + day);
+            expected[i] += i % 7 + day;
+        }
+        deferred.add(daily);
+    }
+    deferred.setValue(1000, 1);
+    expected[1000] = 1;
+    uint64_t minValue = UINT64_MAX;
+    uint64_t maxValue = 0;
+    for (const auto& [columnId, value] : expected) {
+        minValue = std::min(minValue, value);
+        maxValue = std::max(maxValue, value);
+    }
+    assert(deferred.compare(roaring::BsiOperation::GE, maxValue, 0, nullptr)->cardinality() >= 1);
+    assert(deferred.compare(roaring::BsiOperation::GT, maxValue, 0, nullptr)->isEmpty());
+    assert(deferred.compare(roaring::BsiOperation::LE, minValue, 0, nullptr)->cardinality() >= 1);
+    assert(deferred.compare(roaring::BsiOperation::EQ, 1, 0, nullptr)->contains(1000UL));
+    assert(bounds(deferred) ==
+           fmt::format("Roaring64Bsi: minValue {}, maxValue {}", minValue, maxValue));
+    for (const auto& [columnId, value] : expected) {
+        assert(deferred.getValue(columnId) == std::make_tuple(value, true));
+    }
+
+    // serialization writes the refreshed bounds
+    deferred.add(overlap);
+    std::unique_ptr<char[]> buffer;
+    deferred.serializeBuffer(buffer);
+    roaring::Roaring64Bsi restored;
+    restored.deserialize(buffer.get());
+    maxValue = std::max(maxValue, expected[1] + 1000);
+    assert(bounds(restored) == fmt::format("Roaring64Bsi: minValue 0, maxValue {}", maxValue));
+}
+
+void testFrameOfReference() {
+    std::cout << "testFrameOfReference" << std::endl;
+
+    // millisecond timestamps spread over one day
+    constexpr uint64_t kEpoch = 1700000000000;
+    roaring::Roaring64Bsi plain;
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 3000; i++) {
+        rows.emplace_back(((i % 3) << 32) | (i * 5), kEpoch + (i * 104729) % 86400000);
+    }
+    plain.setValues(rows);
+    offset.setValues(rows);
+    assert(offset.getBase() >= kEpoch);
+    assert(offset.bitCount() <= 27 && plain.bitCount() == 41);
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 3000; i += 4) {
+        foundSet.add(((i % 3) << 32) | (i * 5));
+    }
+    auto sameAs = [&](const roaring::Roaring64Bsi& bsi, const roaring::Roaring64Bsi& expected) {
+        for (auto op : {roaring::EQ, roaring::NEQ, roaring::LT, roaring::LE, roaring::GT,
+                        roaring::GE, roaring::RANGE}) {
+            for (uint64_t predicate : {uint64_t {0}, kEpoch, kEpoch + 43200000, UINT64_MAX}) {
+                assert(*bsi.compare(op, predicate, predicate + 1000000, &foundSet) ==
+                       *expected.compare(op, predicate, predicate + 1000000, &foundSet));
+                assert(bsi.countCompare(op, predicate, predicate + 1000000) ==
+                       expected.countCompare(op, predicate, predicate + 1000000));
+            }
+        }
+        assert(bsi.compare(roaring::NEQ, std::get<1>(rows[7]), 0)->cardinality() ==
+               expected.compare(roaring::NEQ, std::get<1>(rows[7]), 0)->cardinality());
+        assert(bsi.sum(nullptr) == expected.sum(nullptr));
+        assert(std::get<0>(bsi.sum(&foundSet)) == std::get<0>(expected.sum(&foundSet)));
+        assert(*bsi.topK(50) == *expected.topK(50));
+        assert(bsi.getValues(foundSet) == expected.getValues(foundSet));
+        assert(bsi.getValue((2UL << 32) | 10) == expected.getValue((2UL << 32) | 10));
+        assert(*bsi.transpose(&foundSet) == *expected.transpose(&foundSet));
+        auto counts = bsi.transposeWithCount(&foundSet);
+        auto expectedCounts = expected.transposeWithCount(&foundSet);
+        assert(counts->getExistenceBitmap() == expectedCounts->getExistenceBitmap());
+    };
+    auto sameAsPlain = [&](const roaring::Roaring64Bsi& bsi) { sameAs(bsi, plain); };
+    sameAsPlain(offset);
+    sameAs(*offset.filter(&foundSet), *plain.filter(&foundSet));
+
+    // all serialized formats keep the base
+    std::unique_ptr<char[]> legacy;
+    offset.serializeBuffer(legacy);
+    roaring::Roaring64Bsi restored;
+    restored.deserialize(legacy.get());
+    assert(restored.getBase() == offset.getBase());
+    sameAsPlain(restored);
+    auto path = (std::filesystem::temp_directory_path() / "bsi_frame_of_reference.bsi").string();
+    [[maybe_unused]] const bool written = roaring::Roaring64BsiView::write(offset, path);
+    assert(written);
+    auto view = roaring::Roaring64BsiView::open(path);
+    sameAsPlain(**view);
+    view.reset();
+    std::filesystem::remove(path);
+    std::vector<char> indexed(offset.indexedSizeInBytes());
+    offset.serializeIndexed(indexed.data());
+    sameAsPlain(*roaring::Roaring64Bsi::deserializeLazy(indexed.data(), indexed.size()));
+
+    // a value below the base lowers it, with headroom for further smaller values
+    offset.setValue(1, kEpoch - 1000);
+    plain.setValue(1, kEpoch - 1000);
+    assert(offset.getBase() <= kEpoch - 1000);
+    sameAsPlain(offset);
+    [[maybe_unused]] const bool raisedPastMin = offset.rebase(kEpoch);
+    assert(!raisedPastMin);
+    [[maybe_unused]] const bool rebased = offset.rebase(kEpoch - 5000);
+    assert(rebased);
+    sameAsPlain(offset);
+
+    // add and merge across bases and plain indexes
+    roaring::Roaring64Bsi later;
+    later.setFrameOfReference(true);
+    roaring::Roaring64Bsi laterPlain;
+    for (uint64_t i = 2000; i < 4000; i++) {
+        uint64_t columnId = ((i % 3) << 32) | (i * 5);
+        later.setValue(columnId, kEpoch + 86400000 + i);
+        laterPlain.setValue(columnId, kEpoch + 86400000 + i);
+    }
+    roaring::Roaring64Bsi sum = offset;
+    sum.add(later);
+    plain.add(laterPlain);
+    sameAsPlain(sum);
+    roaring::Roaring64Bsi plainSum = laterPlain;
+    plainSum.add(offset);
+    assert(plainSum.getBase() == 0);
+    sameAsPlain(plainSum);
+    roaring::Roaring64Bsi manySum = laterPlain;
+    manySum.setFrameOfReference(true);
+    std::vector<const roaring::Roaring64Bsi*> addends {&offset};
+    manySum.addMany(addends);
+    sameAsPlain(manySum);
+
+    roaring::Roaring64Bsi left;
+    left.setFrameOfReference(true);
+    left.setValue(1, 1000);
+    left.setValue(2, 1005);
+    roaring::Roaring64Bsi right;
+    right.setFrameOfReference(true);
+    right.setValue(3, 500);
+    [[maybe_unused]] const bool merged = left.merge(right);
+    assert(merged);
+    assert(left.getBase() == 500);
+    assert(left.getValue(2) == std::make_tuple(1005UL, true));
+    assert(left.getValue(3) == std::make_tuple(500UL, true));
+
+    // switching the mode off re-encodes the absolute values
+    sum.setFrameOfReference(false);
+    assert(sum.getBase() == 0);
+    sameAsPlain(sum);
+
+    // ever smaller writes lower the base with headroom instead of re-encoding on every row
+    roaring::Roaring64Bsi descending;
+    descending.setFrameOfReference(true);
+    for (uint64_t i = 0; i < 20000; i++) {
+        descending.setValue(((i % 3) << 32) | i, kEpoch - i * 7);
+    }
+    assert(descending.getBase() <= kEpoch - 19999 * 7);
+    assert(descending.getExistenceBitmap().cardinality() == 20000);
+    for (uint64_t i = 0; i < 20000; i += 13) {
+        assert(descending.getValue(((i % 3) << 32) | i) == std::make_tuple(kEpoch - i * 7, true));
+    }
+    assert(descending.countCompare(roaring::GE, kEpoch - 700, 0) == 101);
+}
+
+void testChunkZones() {
+    std::cout << "testChunkZones" << std::endl;
+
+    // time-ordered ids: chunk c holds values around c * 1000, chunk 3 also holds an outlier
+    roaring::Roaring64Bsi bsi;
+    std::map<uint64_t, uint64_t> expected;
+    for (uint64_t chunk = 0; chunk < 8; chunk++) {
+        for (uint64_t i = 0; i < 200; i++) {
+            uint64_t columnId = (chunk << 32) | (i * 3);
+            uint64_t value = chunk * 1000 + (i * 37) % 500;
+            bsi.setValue(columnId, value);
+            expected[columnId] = value;
+        }
+    }
+    bsi.setValue((3UL << 32) | 1, 100000);
+    expected[(3UL << 32) | 1] = 100000;
+    // chunk 5 holds a single value
+    for (uint64_t i = 0; i < 200; i++) {
+        bsi.setValue((5UL << 32) | (i * 3), 5123);
+        expected[(5UL << 32) | (i * 3)] = 5123;
+    }
+
+    roaring::Roaring64Map foundSet;
+    for (const auto& [columnId, value] : expected) {
+        // chunks 0 and 5 entirely, every other row elsewhere, and ids without a value
+        if ((columnId >> 32) == 0 || (columnId >> 32) == 5 || columnId % 2 == 0) {
+            foundSet.add(columnId);
+        }
+    }
+    foundSet.add((9UL << 32) | 7);
+
+    auto check = [&](const roaring::Roaring64Bsi& index) {
+        for (auto op : {roaring::EQ, roaring::NEQ, roaring::LT, roaring::LE, roaring::GT,
+                        roaring::GE, roaring::RANGE}) {
+            for (uint64_t start : {0UL, 2499UL, 3000UL, 5123UL, 7400UL, 100000UL}) {
+                const uint64_t end = start + 1500;
+                for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                                       (const roaring::Roaring64Map*)&foundSet}) {
+                    roaring::Roaring64Map scan;
+                    for (const auto& [columnId, value] : expected) {
+                        bool match = op == roaring::EQ      ? value == start
+                                     : op == roaring::NEQ   ? value != start
+                                     : op == roaring::LT    ? value < start
+                                     : op == roaring::LE    ? value <= start
+                                     : op == roaring::GT    ? value > start
+                                     : op == roaring::GE    ? value >= start
+                                                            : value >= start && value <= end;
+                        if (match && (f == nullptr || f->contains(columnId))) {
+                            scan.add(columnId);
+                        }
+                    }
+                    assert(*index.compare(op, start, end, f) == scan);
+                    assert(index.countCompare(op, start, end, f) == scan.cardinality());
+                }
+            }
+        }
+
+        uint64_t foundSum = 0;
+        for (const auto& [columnId, value] : expected) {
+            foundSum += foundSet.contains(columnId) ? value : 0;
+        }
+        assert(std::get<0>(index.sum(&foundSet)) == foundSum);
+
+        for (uint64_t k : {1UL, 150UL, 250UL, 2000UL}) {
+            auto top = index.topK(k);
+            assert(top->cardinality() == std::min<uint64_t>(k, expected.size()));
+            uint64_t selectedMin = UINT64_MAX;
+            uint64_t restMax = 0;
+            for (const auto& [columnId, value] : expected) {
+                if (top->contains(columnId)) {
+                    selectedMin = std::min(selectedMin, value);
+                } else {
+                    restMax = std::max(restMax, value);
+                }
+            }
+            assert(selectedMin >= restMax);
+        }
+    };
+    // the first queries go without zones, the later ones build and use them
+    check(bsi);
+
+    // writes keep the zones: a new row, an overwrite in the single-value chunk, a new chunk
+    bsi.setValue(1, 99999);
+    expected[1] = 99999;
+    bsi.setValue(5UL << 32, 4000);
+    expected[5UL << 32] = 4000;
+    bsi.setValue((9UL << 32) | 7, 60000);
+    expected[(9UL << 32) | 7] = 60000;
+    // and so does a bulk write, overwriting rows of chunk 2 and adding rows to chunk 6
+    std::vector<std::tuple<uint64_t, uint64_t>> written;
+    for (uint64_t i = 0; i < 300; i += 2) {
+        written.emplace_back((2UL << 32) | (i * 3), 7000 + i);
+        written.emplace_back((6UL << 32) | (i * 3 + 1), 100 + i);
+    }
+    bsi.setValues(written);
+    for (const auto& [columnId, value] : written) {
+        expected[columnId] = value;
+    }
+    check(bsi);
+
+    // lowering the base of a frame-of-reference index shifts the sums of its zones
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    std::vector<std::tuple<uint64_t, uint64_t>> shifted;
+    uint64_t shiftedSum = 0;
+    for (const auto& [columnId, value] : expected) {
+        shifted.emplace_back(columnId, value + 5000);
+        shiftedSum += value + 5000;
+    }
+    offset.setValues(shifted);
+    offset.setValue((4UL << 32) | 1, 0);
+    assert(offset.getBase() == 0);
+    roaring::Roaring64Map allRows;
+    allRows.addRange(0, uint64_t {10} << 32);
+    assert(offset.sum(&allRows) == std::make_tuple(shiftedSum, expected.size() + 1));
+    assert(offset.countCompare(roaring::LT, 5000, 0, &allRows) == 1);
+
+    // a bulk load into an empty index fills the zones from the rows
+    roaring::Roaring64Bsi loaded;
+    std::vector<std::tuple<uint64_t, uint64_t>> rows(expected.begin(), expected.end());
+    loaded.setValues(rows);
+    for (auto op : {roaring::EQ, roaring::NEQ, roaring::LT, roaring::GE, roaring::RANGE}) {
+        for (uint64_t start : {0UL, 2499UL, 5123UL, 100000UL}) {
+            assert(*loaded.compare(op, start, start + 1500, &foundSet) ==
+                   *bsi.compare(op, start, start + 1500, &foundSet));
+        }
+    }
+    assert(loaded.sum(&foundSet) == bsi.sum(&foundSet));
+    assert(loaded.topK(250)->cardinality() == 250);
+}
+
+void testRangeBsi() {
+    std::cout << "testRangeBsi" << std::endl;
+
+    roaring::Roaring64Bsi bsi;
+    roaring::Roaring64RangeBsi rangeBsi;
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 4000; i++) {
+        rows.emplace_back(((i % 2) << 32) | (i * 7), (i * 2654435761) % 100000);
+    }
+    // duplicate columnIds: the last row wins
+    rows.emplace_back(7, 99999);
+    rows.emplace_back(7, 12345);
+    bsi.setValues(rows);
+    rangeBsi.setValues(rows);
+    bsi.setValue(14, 0);
+    rangeBsi.setValue(14, 0);
+    assert(std::get<0>(rangeBsi.getValue(7)) == 12345);
+    assert(rangeBsi.bitCount() == bsi.bitCount());
+
+    roaring::Roaring64Map smallSet;
+    roaring::Roaring64Map largeSet;
+    for (uint64_t i = 0; i < 4000; i++) {
+        uint64_t columnId = ((i % 2) << 32) | (i * 7);
+        (i % 50 == 0 ? smallSet : largeSet).add(columnId);
+    }
+    largeSet.add((5UL << 32) | 1);
+
+    auto sameAs = [&](const roaring::Roaring64RangeBsi& actual,
+                      const roaring::Roaring64Bsi& expected) {
+        for (auto op : {roaring::EQ, roaring::NEQ, roaring::LT, roaring::LE, roaring::GT,
+                        roaring::GE, roaring::RANGE}) {
+            for (uint64_t predicate : {0UL, 1UL, 12345UL, 65535UL, 65536UL, 99999UL, 200000UL}) {
+                for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                                       (const roaring::Roaring64Map*)&smallSet,
+                                                       (const roaring::Roaring64Map*)&largeSet}) {
+                    assert(*actual.compare(op, predicate, predicate + 40000, f) ==
+                           *expected.compare(op, predicate, predicate + 40000, f));
+                    assert(actual.countCompare(op, predicate, predicate + 40000, f) ==
+                           expected.countCompare(op, predicate, predicate + 40000, f));
+                }
+            }
+        }
+        assert(actual.compare(roaring::UNKNOWN, 0, 0) == nullptr);
+        assert(actual.sum(nullptr) == expected.sum(nullptr));
+        assert(std::get<0>(actual.sum(&largeSet)) == std::get<0>(expected.sum(&largeSet)));
+        const uint64_t largeCount = expected.getExistenceBitmap().and_cardinality(largeSet);
+        assert(std::get<1>(actual.sum(&largeSet)) == largeCount);
+
+        for (uint64_t k : {1UL, 100UL, 3900UL, 5000UL}) {
+            auto top = actual.topK(k, &largeSet);
+            assert(top->cardinality() == std::min(k, largeCount));
+            uint64_t selectedMin = UINT64_MAX;
+            uint64_t restMax = 0;
+            for (auto columnId : expected.getExistenceBitmap()) {
+                if (!largeSet.contains(columnId)) {
+                    continue;
+                }
+                uint64_t value = std::get<0>(expected.getValue(columnId));
+                if (top->contains(columnId)) {
+                    selectedMin = std::min(selectedMin, value);
+                } else {
+                    restMax = std::max(restMax, value);
+                }
+            }
+            assert(selectedMin >= restMax);
+        }
+        for (auto columnId : expected.getExistenceBitmap()) {
+            assert(actual.getValue(columnId) == expected.getValue(columnId));
+        }
+    };
+    sameAs(rangeBsi, bsi);
+    sameAs(*roaring::Roaring64RangeBsi::fromBsi(bsi), bsi);
+    sameAs(rangeBsi, *rangeBsi.toBsi());
+
+    // one serialization format, read by either encoding
+    std::unique_ptr<char[]> buffer(new char[rangeBsi.serializedSizeInBytes()]);
+    [[maybe_unused]] const size_t written = rangeBsi.serialize(buffer.get());
+    assert(written == rangeBsi.serializedSizeInBytes());
+    roaring::Roaring64Bsi fromRange;
+    fromRange.deserialize(buffer.get());
+    sameAs(rangeBsi, fromRange);
+    roaring::Roaring64RangeBsi roundTrip;
+    roundTrip.deserialize(buffer.get());
+    sameAs(roundTrip, bsi);
+    std::unique_ptr<char[]> binary;
+    bsi.serializeBuffer(binary);
+    roaring::Roaring64RangeBsi fromBinary;
+    fromBinary.deserialize(binary.get());
+    sameAs(fromBinary, bsi);
+
+    // a frame-of-reference base carries over, and a lower value moves it down
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    std::vector<std::tuple<uint64_t, uint64_t>> shifted;
+    for (const auto& [columnId, value] : rows) {
+        shifted.emplace_back(columnId, value + 1000000);
+    }
+    offset.setValues(shifted);
+    auto offsetRange = roaring::Roaring64RangeBsi::fromBsi(offset);
+    assert(offsetRange->getBase() == 1000000);
+    sameAs(*offsetRange, offset);
+    std::unique_ptr<char[]> offsetBuffer(new char[offsetRange->serializedSizeInBytes()]);
+    offsetRange->serialize(offsetBuffer.get());
+    roaring::Roaring64Bsi offsetCopy;
+    offsetCopy.deserialize(offsetBuffer.get());
+    assert(offsetCopy.getBase() == 1000000);
+    sameAs(*offsetRange, offsetCopy);
+
+    offset.setValue(3, 500);
+    offsetRange->setValue(3, 500);
+    assert(offsetRange->getBase() <= 500);
+    sameAs(*offsetRange, offset);
+}
+
+void testEqIndex() {
+    std::cout << "testEqIndex" << std::endl;
+
+    // a categorical column: 12 values, skewed towards the small ones
+    roaring::Roaring64Bsi bsi;
+    roaring::Roaring64EqIndex eqIndex;
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 5000; i++) {
+        rows.emplace_back(i * 3, (i * i) % 97 % 12 * 10);
+    }
+    rows.emplace_back(30, 110);
+    bsi.setValues(rows);
+    eqIndex.setValues(rows);
+    bsi.setValue(6, 999);
+    eqIndex.setValue(6, 999);
+    bsi.setValue(9, 20);
+    eqIndex.setValue(9, 20);
+    assert(eqIndex.distinctCount() == 13);
+    assert(std::get<0>(eqIndex.getValue(30)) == 110);
+    assert(!std::get<1>(eqIndex.getValue(31)));
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 15000; i += 7) {
+        foundSet.add(i);
+    }
+    auto sameAs = [&](const auto& actual, const roaring::Roaring64Bsi& expected) {
+        for (auto op : {roaring::EQ, roaring::NEQ, roaring::LT, roaring::LE, roaring::GT,
+                        roaring::GE, roaring::RANGE}) {
+            for (uint64_t predicate : {0UL, 5UL, 20UL, 55UL, 110UL, 999UL, 1000UL}) {
+                for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                                       (const roaring::Roaring64Map*)&foundSet}) {
+                    assert(*actual.compare(op, predicate, predicate + 40, f) ==
+                           *expected.compare(op, predicate, predicate + 40, f));
+                    assert(actual.countCompare(op, predicate, predicate + 40, f) ==
+                           expected.countCompare(op, predicate, predicate + 40, f));
+                }
+            }
+        }
+        assert(actual.compare(roaring::UNKNOWN, 0, 0) == nullptr);
+        assert(actual.sum(nullptr) == expected.sum(nullptr));
+        assert(std::get<0>(actual.sum(&foundSet)) == std::get<0>(expected.sum(&foundSet)));
+        for (uint64_t k : {0UL, 1UL, 7UL, 600UL, 5000UL, 6000UL}) {
+            assert(*actual.topK(k) == *expected.topK(k));
+            assert(*actual.topK(k, &foundSet) == *expected.topK(k, &foundSet));
+        }
+        assert(actual.getExistenceBitmap() == expected.getExistenceBitmap());
+        for (auto columnId : expected.getExistenceBitmap()) {
+            assert(actual.getValue(columnId) == expected.getValue(columnId));
+        }
+    };
+    sameAs(eqIndex, bsi);
+    auto converted = eqIndex.toBsi();
+    sameAs(eqIndex, *converted);
+
+    // IN lists: duplicates and values without rows are ignored
+    std::vector<uint64_t> in {20, 999, 20, 7, 110};
+    roaring::Roaring64Map expectedIn;
+    for (auto value : {20UL, 999UL, 110UL}) {
+        expectedIn |= *bsi.compare(roaring::EQ, value, 0);
+    }
+    assert(*eqIndex.compareIn(in) == expectedIn);
+    assert(*eqIndex.compareIn(in, &foundSet) == (expectedIn & foundSet));
+    assert(eqIndex.compareIn({})->isEmpty());
+
+    // the adaptive index keeps the equality encoding while the column has few values
+    roaring::Roaring64AdaptiveIndex adaptive(16);
+    adaptive.setValues(rows);
+    adaptive.setValue(6, 999);
+    adaptive.setValue(9, 20);
+    assert(adaptive.isEqualityEncoded() && adaptive.getBsi() == nullptr);
+    sameAs(adaptive, bsi);
+    for (uint64_t value = 1000; value < 1003; value++) {
+        adaptive.setValue(value * 3, value);
+        bsi.setValue(value * 3, value);
+    }
+    assert(adaptive.isEqualityEncoded());
+    adaptive.setValue(1, 5000);
+    bsi.setValue(1, 5000);
+    assert(!adaptive.isEqualityEncoded() && adaptive.getEqIndex() == nullptr);
+    sameAs(adaptive, bsi);
+
+    // a batch with too many values converts before it is written
+    roaring::Roaring64AdaptiveIndex batch(16);
+    std::vector<std::tuple<uint64_t, uint64_t>> wide;
+    for (uint64_t i = 0; i < 100; i++) {
+        wide.emplace_back(i, i);
+    }
+    batch.setValues(wide);
+    assert(!batch.isEqualityEncoded());
+    roaring::Roaring64Bsi wideBsi;
+    wideBsi.setValues(wide);
+    sameAs(batch, wideBsi);
+}
+
+void testCompareIn() {
+    std::cout << "testCompareIn" << std::endl;
+
+    std::map<uint64_t, uint64_t> expected;
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 6000; i++) {
+        uint64_t columnId = ((i % 3) << 32) | (i * 5);
+        uint64_t value = 100000 + (i % 3) * 50000 + (i * 7919) % 3000;
+        rows.emplace_back(columnId, value);
+        expected[columnId] = value;
+    }
+    roaring::Roaring64Bsi plain;
+    plain.setValues(rows);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValues(rows);
+    roaring::Roaring64Bsi pooled = plain;
+    pooled.setThreadPool(std::make_shared<roaring::ThreadPool>(3));
+    // one chunk: the whole-map trie without zones
+    roaring::Roaring64Bsi packed;
+    std::map<uint64_t, uint64_t> packedExpected;
+    for (const auto& [columnId, value] : rows) {
+        packed.setValue(columnId & UINT32_MAX, value);
+        packedExpected[columnId & UINT32_MAX] = value;
+    }
+
+    roaring::Roaring64Map smallSet;
+    roaring::Roaring64Map largeSet;
+    for (const auto& [columnId, value] : expected) {
+        (columnId % 7 == 0 ? smallSet : largeSet).add(columnId);
+        (columnId % 7 == 0 ? smallSet : largeSet).add(columnId & UINT32_MAX);
+    }
+
+    std::vector<std::vector<uint64_t>> lists {
+            {},
+            {0, UINT64_MAX, 99999, 203000},
+            {100000, 100000, 150001, 200002},
+    };
+    std::vector<uint64_t> wide;
+    for (uint64_t value = 99990; value < 203010; value += 13) {
+        wide.push_back(value);
+    }
+    lists.push_back(wide);
+    assert(plain.compareIn(wide)->cardinality() > 100);
+
+    auto check = [&](const roaring::Roaring64Bsi& bsi, const std::map<uint64_t, uint64_t>& data) {
+        for (const auto& values : lists) {
+            for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                                   (const roaring::Roaring64Map*)&smallSet,
+                                                   (const roaring::Roaring64Map*)&largeSet}) {
+                roaring::Roaring64Map scan;
+                for (const auto& [columnId, value] : data) {
+                    if (std::find(values.begin(), values.end(), value) != values.end() &&
+                        (f == nullptr || f->contains(columnId))) {
+                        scan.add(columnId);
+                    }
+                }
+                assert(*bsi.compareIn(values, f) == scan);
+            }
+        }
+    };
+    check(plain, expected);
+    check(offset, expected);
+    check(pooled, expected);
+    check(packed, packedExpected);
+
+    roaring::Roaring64AdaptiveIndex adaptive(4);
+    adaptive.setValues(rows);
+    assert(!adaptive.isEqualityEncoded());
+    assert(*adaptive.compareIn(wide, &largeSet) == *plain.compareIn(wide, &largeSet));
+}
+
+void testHistogram() {
+    std::cout << "testHistogram" << std::endl;
+
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 6000; i++) {
+        rows.emplace_back(((i % 3) << 32) | (i * 5), 5000 + (i % 3) * 3000 + (i * 7919) % 2500);
+    }
+    rows.emplace_back(1, 0);
+    roaring::Roaring64Bsi plain;
+    plain.setValues(rows);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValues(rows);
+    roaring::Roaring64Bsi pooled = plain;
+    pooled.setThreadPool(std::make_shared<roaring::ThreadPool>(3));
+    roaring::Roaring64Bsi packed;
+    for (const auto& [columnId, value] : rows) {
+        packed.setValue(columnId & UINT32_MAX, value);
+    }
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 6000; i += 3) {
+        foundSet.add(((i % 3) << 32) | (i * 5));
+        foundSet.add((i * 5) & UINT32_MAX);
+    }
+
+    std::vector<std::vector<uint64_t>> boundaryLists {
+            {},
+            {0},
+            {1, 5000, 5001, 7000, 8000, 9999, 10000, 12000, UINT64_MAX},
+            {4000, 4500},
+            {20000},
+    };
+    std::vector<uint64_t> many;
+    for (uint64_t b = 4990; b < 10600; b += 97) {
+        many.push_back(b);
+    }
+    boundaryLists.push_back(many);
+
+    for (const auto* bsi : {&plain, &offset, &pooled, &packed}) {
+        for (const auto& boundaries : boundaryLists) {
+            for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                                   (const roaring::Roaring64Map*)&foundSet}) {
+                auto counts = bsi->histogram(boundaries, f);
+                assert(counts.size() == boundaries.size() + 1);
+                uint64_t below = 0;
+                for (size_t b = 0; b < boundaries.size(); b++) {
+                    uint64_t lt = bsi->countCompare(roaring::LT, boundaries[b], 0, f);
+                    assert(counts[b] == lt - below);
+                    below = lt;
+                }
+                uint64_t total = f != nullptr
+                                         ? bsi->getExistenceBitmap().and_cardinality(*f)
+                                         : bsi->getExistenceBitmap().cardinality();
+                assert(counts.back() == total - below);
+            }
+        }
+    }
+
+    // boundaries must be strictly increasing
+    std::vector<uint64_t> unsorted {10, 5};
+    std::vector<uint64_t> repeated {10, 10};
+    assert(plain.histogram(unsorted).empty());
+    assert(plain.histogram(repeated).empty());
+}
+
+void testQuantile() {
+    std::cout << "testQuantile" << std::endl;
+
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 5000; i++) {
+        rows.emplace_back(((i % 3) << 32) | (i * 7), 3000 + (i * 7919) % 1700);
+    }
+    rows.emplace_back(3, 3000);
+    rows.emplace_back(4, 9000);
+    roaring::Roaring64Bsi plain;
+    plain.setValues(rows);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValues(rows);
+    roaring::Roaring64Bsi pooled = plain;
+    pooled.setThreadPool(std::make_shared<roaring::ThreadPool>(3));
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 5000; i += 4) {
+        foundSet.add(((i % 3) << 32) | (i * 7));
+    }
+    foundSet.add(uint64_t {4});
+    foundSet.add(uint64_t {5}); // no value
+
+    for (const auto* bsi : {&plain, &offset, &pooled}) {
+        for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                               (const roaring::Roaring64Map*)&foundSet}) {
+            std::vector<uint64_t> sorted;
+            for (const auto& [columnId, value] : rows) {
+                if (f == nullptr || f->contains(columnId)) {
+                    sorted.push_back(value);
+                }
+            }
+            std::sort(sorted.begin(), sorted.end());
+            for (uint64_t rank = 0; rank < sorted.size(); rank += 37) {
+                assert(bsi->kthValue(rank, f) == std::make_tuple(sorted[rank], true));
+            }
+            assert(bsi->kthValue(sorted.size() - 1, f) == std::make_tuple(sorted.back(), true));
+            assert(!std::get<1>(bsi->kthValue(sorted.size(), f)));
+
+            assert(bsi->quantile(0, f) == std::make_tuple(sorted.front(), true));
+            assert(bsi->quantile(1, f) == std::make_tuple(sorted.back(), true));
+            for (double q : {0.01, 0.25, 0.5, 0.9, 0.99, 0.999}) {
+                auto rank = static_cast<uint64_t>(std::ceil(q * sorted.size())) - 1;
+                assert(bsi->quantile(q, f) == std::make_tuple(sorted[rank], true));
+            }
+        }
+    }
+
+    // a single row, no rows, q out of range
+    roaring::Roaring64Bsi single;
+    single.setValue(42, 7);
+    assert(single.quantile(0.5) == std::make_tuple(7, true));
+    assert(single.kthValue(0) == std::make_tuple(7, true));
+    roaring::Roaring64Map none;
+    assert(!std::get<1>(plain.quantile(0.5, &none)));
+    assert(!std::get<1>(roaring::Roaring64Bsi().quantile(0.5)));
+    assert(!std::get<1>(plain.quantile(-0.1)));
+    assert(!std::get<1>(plain.quantile(1.5)));
+    assert(!std::get<1>(plain.quantile(std::nan(""))));
+}
+
+void testMinMax() {
+    std::cout << "testMinMax" << std::endl;
+
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 6000; i++) {
+        rows.emplace_back(((i % 4) << 32) | (i * 3), 2000 + (i % 4) * 500 + (i * 7919) % 1200);
+    }
+    roaring::Roaring64Bsi plain;
+    plain.setValues(rows);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValues(rows);
+    roaring::Roaring64Bsi packed;
+    for (const auto& [columnId, value] : rows) {
+        packed.setValue(columnId & UINT32_MAX, value);
+    }
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 6000; i += 5) {
+        foundSet.add(((i % 4) << 32) | (i * 3));
+        foundSet.add((i * 3) & UINT32_MAX);
+    }
+    roaring::Roaring64Map single;
+    single.add(std::get<0>(rows[76]));
+
+    for (const auto* bsi : {&plain, &offset, &packed}) {
+        for (const roaring::Roaring64Map* f :
+             {(const roaring::Roaring64Map*)nullptr, (const roaring::Roaring64Map*)&foundSet,
+              (const roaring::Roaring64Map*)&single}) {
+            uint64_t minValue = UINT64_MAX;
+            uint64_t maxValue = 0;
+            for (auto columnId : bsi->getExistenceBitmap()) {
+                if (f == nullptr || f->contains(columnId)) {
+                    auto value = std::get<0>(bsi->getValue(columnId));
+                    minValue = std::min(minValue, value);
+                    maxValue = std::max(maxValue, value);
+                }
+            }
+            assert(bsi->min(f) == std::make_tuple(minValue, true));
+            assert(bsi->max(f) == std::make_tuple(maxValue, true));
+
+            auto [argMinValue, argMinRows] = bsi->argMin(f);
+            auto [argMaxValue, argMaxRows] = bsi->argMax(f);
+            assert(argMinValue == minValue && argMaxValue == maxValue);
+            auto expectedMin = *bsi->compare(roaring::EQ, minValue, 0, f);
+            auto expectedMax = *bsi->compare(roaring::EQ, maxValue, 0, f);
+            assert(*argMinRows == expectedMin && *argMaxRows == expectedMax);
+        }
+    }
+
+    // no rows
+    roaring::Roaring64Map none;
+    none.add(uint64_t {1});
+    assert(!std::get<1>(plain.min(&none)));
+    assert(!std::get<1>(plain.max(&none)));
+    assert(std::get<1>(plain.argMax(&none))->isEmpty());
+    assert(!std::get<1>(roaring::Roaring64Bsi().min()));
+
+    // all values zero
+    roaring::Roaring64Bsi zeros;
+    zeros.setValue(5, 0);
+    zeros.setValue(9, 0);
+    auto [zeroValue, zeroRows] = zeros.argMax();
+    assert(zeroValue == 0 && zeroRows->cardinality() == 2);
+}
+
+void testWideSum() {
+    std::cout << "testWideSum" << std::endl;
+
+    // the total of these values does not fit in 64 bits
+    const uint64_t big = UINT64_MAX - 5;
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 3000; i++) {
+        rows.emplace_back(((i % 2) << 32) | i, big - (i % 7));
+    }
+    unsigned __int128 expected = 0;
+    unsigned __int128 expectedFound = 0;
+    roaring::Roaring64Map foundSet;
+    for (const auto& [columnId, value] : rows) {
+        expected += value;
+        if (columnId % 3 == 0) {
+            foundSet.add(columnId);
+            expectedFound += value;
+        }
+    }
+    const uint64_t foundCount = foundSet.cardinality();
+    foundSet.add(uint64_t {1} << 40); // no value: not counted
+
+    roaring::Roaring64Bsi plain;
+    plain.setValues(rows);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValues(rows);
+    roaring::Roaring64Bsi single;
+    for (const auto& [columnId, value] : rows) {
+        single.setValue(columnId & UINT32_MAX, value);
+    }
+    for (const auto* bsi : {&plain, &offset}) {
+        assert(bsi->sum(nullptr) == std::make_tuple(expected, uint64_t {3000}));
+        assert(bsi->sum(&foundSet) == std::make_tuple(expectedFound, foundCount));
+    }
+    // one high-key chunk, without zones
+    assert(std::get<0>(single.sum(nullptr)) == expected);
+    const uint64_t singleCount = single.getExistenceBitmap().and_cardinality(foundSet);
+    assert(std::get<1>(single.sum(&foundSet)) == singleCount);
+
+    auto range = roaring::Roaring64RangeBsi::fromBsi(plain);
+    assert(range->sum(&foundSet) == std::make_tuple(expectedFound, foundCount));
+    roaring::Roaring64EqIndex eqIndex;
+    eqIndex.setValues(rows);
+    assert(eqIndex.sum(nullptr) == std::make_tuple(expected, uint64_t {3000}));
+    assert(eqIndex.sum(&foundSet) == std::make_tuple(expectedFound, foundCount));
+}
+
+void testSumOfSquares() {
+    std::cout << "testSumOfSquares" << std::endl;
+
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 5000; i++) {
+        rows.emplace_back(((i % 3) << 32) | (i * 11), 70000 + (i * 7919) % 90000);
+    }
+    roaring::Roaring64Bsi plain;
+    plain.setValues(rows);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValues(rows);
+    roaring::Roaring64Bsi pooled = offset;
+    pooled.setThreadPool(std::make_shared<roaring::ThreadPool>(4));
+
+    roaring::Roaring64Map foundSet;
+    for (uint64_t i = 0; i < 5000; i += 3) {
+        foundSet.add(((i % 3) << 32) | (i * 11));
+    }
+    foundSet.add(uint64_t {7}); // no value
+
+    for (const roaring::Roaring64Map* f : {(const roaring::Roaring64Map*)nullptr,
+                                           (const roaring::Roaring64Map*)&foundSet}) {
+        unsigned __int128 squares = 0;
+        uint64_t sum = 0;
+        uint64_t count = 0;
+        for (const auto& [columnId, value] : rows) {
+            if (f == nullptr || f->contains(columnId)) {
+                squares += static_cast<unsigned __int128>(value) * value;
+                sum += value;
+                count++;
+            }
+        }
+        const double mean = static_cast<double>(sum) / count;
+        double variance = 0;
+        for (const auto& [columnId, value] : rows) {
+            if (f == nullptr || f->contains(columnId)) {
+                variance += (value - mean) * (value - mean) / count;
+            }
+        }
+
+        for (const auto* bsi : {&plain, &offset, &pooled}) {
+            assert(bsi->sumOfSquares(f) == std::make_tuple(squares, count));
+            auto [actual, exists] = bsi->variance(f);
+            assert(exists && std::abs(actual - variance) < variance * 1e-9);
+            auto [deviation, deviationExists] = bsi->stddev(f);
+            assert(deviationExists && std::abs(deviation - std::sqrt(variance)) < 1e-6);
+        }
+    }
+
+    // no rows, a single value
+    roaring::Roaring64Map none;
+    assert(!std::get<1>(plain.variance(&none)));
+    assert(plain.sumOfSquares(&none) == std::make_tuple(0, 0));
+    roaring::Roaring64Bsi constant;
+    constant.setValue(1, 5);
+    constant.setValue(2, 5);
+    assert(constant.variance(nullptr) == std::make_tuple(0.0, true));
+    assert(constant.sumOfSquares(nullptr) == std::make_tuple(50, 2));
+
+    // a small spread on a large offset: 1e15 + 0..9, whose variance is 8.25
+    constexpr uint64_t kOffset = 1000000000000000;
+    roaring::Roaring64Bsi large;
+    roaring::Roaring64Bsi largeOffset;
+    largeOffset.setFrameOfReference(true);
+    roaring::Roaring64Map evens;
+    for (uint64_t i = 0; i < 1000; i++) {
+        large.setValue(((i % 2) << 32) | i, kOffset + i % 10);
+        largeOffset.setValue(((i % 2) << 32) | i, kOffset + i % 10);
+        if (i % 2 == 0) {
+            evens.add(i);
+        }
+    }
+    for (const auto* bsi : {&large, &largeOffset}) {
+        assert(bsi->variance(nullptr) == std::make_tuple(8.25, true));
+        assert(bsi->stddev(nullptr) == std::make_tuple(std::sqrt(8.25), true));
+        // 0, 2, .., 8
+        assert(bsi->variance(&evens) == std::make_tuple(8.0, true));
+    }
+}
+
+void testGroupSum() {
+    std::cout << "testGroupSum" << std::endl;
+
+    // sparse chunks, and a dense one whose windows decode word-wise
+    std::vector<std::tuple<uint64_t, uint64_t>> rows;
+    for (uint64_t i = 0; i < 8000; i++) {
+        rows.emplace_back(((i % 4) << 32) | (i * 13), 500 + (i * 7919) % 100000);
+    }
+    for (uint64_t i = 0; i < 140000; i++) {
+        rows.emplace_back((uint64_t {5} << 32) | (i + 1000), (i * 104729) % 3000000);
+    }
+    roaring::Roaring64Bsi plain;
+    plain.setValues(rows);
+    roaring::Roaring64Bsi offset;
+    offset.setFrameOfReference(true);
+    offset.setValues(rows);
+    roaring::Roaring64Bsi pooled = plain;
+    pooled.setThreadPool(std::make_shared<roaring::ThreadPool>(3));
+    roaring::Roaring64Bsi packed;
+    for (const auto& [columnId, value] : rows) {
+        packed.setValue(columnId & UINT32_MAX, value);
+    }
+
+    // groups by residue, a whole chunk and rows without values, along with an empty group and
+    // all rows
+    std::vector<roaring::Roaring64Map> groupSets(22);
+    for (const auto& [columnId, value] : rows) {
+        groupSets[(columnId * 0x9E3779B97F4A7C15ULL >> 59) % 20].add(columnId);
+        if ((columnId >> 32) == 2) {
+            groupSets[20].add(columnId);
+        }
+    }
+    groupSets[21].add(uint64_t {3});
+    groupSets[21].add(uint64_t {9} << 40);
+    roaring::Roaring64Map emptyGroup;
+    std::vector<const roaring::Roaring64Map*> groups {&emptyGroup, nullptr};
+    for (const auto& group : groupSets) {
+        groups.push_back(&group);
+    }
+
+    for (const auto* bsi : {&plain, &offset, &pooled, &packed}) {
+        // few groups intersect each slice, many decode the chunks
+        for (size_t count : {size_t {6}, groups.size()}) {
+            auto some = std::span(groups).first(count);
+            auto sums = bsi->groupSum(some);
+            assert(sums.size() == count);
+            for (size_t g = 0; g < count; g++) {
+                assert(sums[g] == bsi->sum(some[g]));
+            }
+        }
+    }
+    assert(plain.groupSum({}).empty());
+    assert(roaring::Roaring64Bsi().groupSum(groups)[1] == std::make_tuple(0, 0));
+}
+
 int main() {
     testSetAndGet();
     testMerge();
@@ -575,6 +2074,28 @@ int main() {
     testIssue743();
     testIssue753();
     testIssue755();
+    testCompareAgainstScan();
+    testParallel();
+    testBulkLoad();
+    testGetValues();
+    testTransposeWithCountEngines();
+    testFrozenView();
+    testIndexedLazy();
+    testCopyOnWrite();
+    testAddRippleCarry();
+    testAddMany();
+    testMinMaxMaintenance();
+    testFrameOfReference();
+    testChunkZones();
+    testRangeBsi();
+    testEqIndex();
+    testCompareIn();
+    testHistogram();
+    testQuantile();
+    testMinMax();
+    testWideSum();
+    testSumOfSquares();
+    testGroupSum();
     std::cout << "All tests passed!" << std::endl;
 
     return 0;
@@ -745,7 +745,7 @@ public:
      * For advanced users.
      * This function may throw std::runtime_error.
      */
-    static const Roaring frozenView(const char *buf, size_t length) {
+    static Roaring frozenView(const char *buf, size_t length) {
         const roaring_bitmap_t *s =
             api::roaring_bitmap_frozen_view(buf, length);
         if (s == NULL) {
@@ -1274,19 +1274,26 @@ public:
      * Adds 'n_args' values from the contiguous memory range starting at 'vals'.
      */
     void addMany(size_t n_args, const uint64_t *vals) {
-        // Potentially reduce outer map lookups by optimistically
-        // assuming that adjacent values will belong to the same inner bitmap.
-        Roaring *last_inner_bitmap = nullptr;
-        uint32_t last_value_high = 0;
-        for (size_t lcv = 0; lcv < n_args; lcv++) {
-            auto value = vals[lcv];
-            auto value_high = highBytes(value);
-            auto value_low = lowBytes(value);
-            if (last_inner_bitmap == nullptr || value_high != last_value_high) {
-                last_inner_bitmap = &lookupOrCreateInner(value_high);
-                last_value_high = value_high;
+        // Adjacent values usually belong to the same inner bitmap: hand each
+        // such run to the inner bitmap's addMany in batches, so that sorted
+        // input is appended container by container.
+        constexpr size_t batch_size = 256;
+        uint32_t low_values[batch_size];
+        size_t lcv = 0;
+        while (lcv < n_args) {
+            auto value_high = highBytes(vals[lcv]);
+            auto &inner_bitmap = lookupOrCreateInner(value_high);
+            size_t count = 0;
+            for (; lcv < n_args && highBytes(vals[lcv]) == value_high; lcv++) {
+                low_values[count++] = lowBytes(vals[lcv]);
+                if (count == batch_size) {
+                    inner_bitmap.addMany(count, low_values);
+                    count = 0;
+                }
+            }
+            if (count > 0) {
+                inner_bitmap.addMany(count, low_values);
             }
-            last_inner_bitmap->add(value_low);
         }
     }
 
@@ -1840,6 +1847,81 @@ public:
         return isSubset(r) && cardinality() != r.cardinality();
     }
 
+    /**
+     * Computes the size of the intersection between two bitmaps without
+     * materializing it. The inner bitmaps are visited in key order, so
+     * each pair of matching 32-bit bitmaps is intersected once.
+     */
+    uint64_t and_cardinality(const Roaring64Map &r) const {
+        uint64_t card = 0;
+        auto self_iter = roarings.cbegin();
+        auto other_iter = r.roarings.cbegin();
+        while (self_iter != roarings.cend() && other_iter != r.roarings.cend()) {
+            if (self_iter->first < other_iter->first) {
+                ++self_iter;
+            } else if (other_iter->first < self_iter->first) {
+                ++other_iter;
+            } else {
+                card += self_iter->second.and_cardinality(other_iter->second);
+                ++self_iter;
+                ++other_iter;
+            }
+        }
+        return card;
+    }
+
+    /**
+     * Computes the size of the difference (andnot) between two bitmaps
+     * without materializing it.
+     */
+    uint64_t andnot_cardinality(const Roaring64Map &r) const {
+        return cardinality() - and_cardinality(r);
+    }
+
+    /**
+     * Returns true if the bitmaps share at least one value. Stops at the
+     * first intersecting pair of inner bitmaps.
+     */
+    bool intersect(const Roaring64Map &r) const {
+        auto self_iter = roarings.cbegin();
+        auto other_iter = r.roarings.cbegin();
+        while (self_iter != roarings.cend() && other_iter != r.roarings.cend()) {
+            if (self_iter->first < other_iter->first) {
+                ++self_iter;
+            } else if (other_iter->first < self_iter->first) {
+                ++other_iter;
+            } else {
+                if (self_iter->second.intersect(other_iter->second)) {
+                    return true;
+                }
+                ++self_iter;
+                ++other_iter;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * For advanced users.
+     * Read-only access to the inner 32-bit bitmaps, keyed by the high 32
+     * bits of the values they hold. Each key can be processed independently.
+     */
+    const std::map<uint32_t, Roaring> &getRoarings() const { return roarings; }
+
+    /**
+     * For advanced users.
+     * Replaces the inner 32-bit bitmap holding the values whose high 32 bits
+     * are 'key'. An empty 'r' removes the key.
+     */
+    void setRoaring(uint32_t key, Roaring &&r) {
+        if (r.isEmpty()) {
+            roarings.erase(key);
+            return;
+        }
+        r.setCopyOnWrite(copyOnWrite);
+        roarings.insert_or_assign(key, std::move(r));
+    }
+
     /**
      * Convert the bitmap to an array. Write the output to "ans",
      * caller is responsible to ensure that there is enough memory
@@ -2255,7 +2337,11 @@ public:
             });
     }
 
-    static const Roaring64Map frozenView(const char *buf) {
+    /**
+     * For advanced users. The inner bitmaps are views into 'buf', which must
+     * outlive the result and stay unmodified; nothing is copied.
+     */
+    static Roaring64Map frozenView(const char *buf) {
         // size of bitmap buffer and key
         const size_t metadata_size = sizeof(size_t) + sizeof(uint32_t);
 
@@ -2280,9 +2366,10 @@ public:
             memcpy(&key, buf, sizeof(uint32_t));
             buf += sizeof(uint32_t);
 
-            // read map value Roaring
-            const Roaring read = Roaring::frozenView(buf, len);
-            result.emplaceOrInsert(key, read);
+            // read map value Roaring; moved, since copying a frozen view
+            // would deep-copy its containers
+            Roaring read = Roaring::frozenView(buf, len);
+            result.emplaceOrInsert(key, std::move(read));
 
             // forward buffer past the last Roaring Bitmap
             buf += len;
@@ -2357,7 +2444,26 @@ public:
      * many temporary bitmaps.
      */
     Roaring64Map operator&(const Roaring64Map &o) const {
-        return Roaring64Map(*this) &= o;
+        // Built key by key from the inner intersections instead of copying
+        // *this and intersecting in place, so that nothing outside the result
+        // is ever copied.
+        Roaring64Map result;
+        result.copyOnWrite = copyOnWrite;
+        auto self_iter = roarings.cbegin();
+        auto other_iter = o.roarings.cbegin();
+        while (self_iter != roarings.cend() && other_iter != o.roarings.cend()) {
+            if (self_iter->first < other_iter->first) {
+                self_iter = roarings.lower_bound(other_iter->first);
+            } else if (other_iter->first < self_iter->first) {
+                other_iter = o.roarings.lower_bound(self_iter->first);
+            } else {
+                result.setRoaring(self_iter->first,
+                                  self_iter->second & other_iter->second);
+                ++self_iter;
+                ++other_iter;
+            }
+        }
+        return result;
     }
 
     /**
@@ -2365,7 +2471,22 @@ public:
      * The current bitmap and the provided bitmap are unchanged.
      */
     Roaring64Map operator-(const Roaring64Map &o) const {
-        return Roaring64Map(*this) -= o;
+        // Built key by key like operator&: only inner bitmaps that 'o' does
+        // not touch are copied (sharing containers under copy-on-write).
+        Roaring64Map result;
+        result.copyOnWrite = copyOnWrite;
+        auto other_iter = o.roarings.cbegin();
+        for (const auto &[key, bitmap] : roarings) {
+            while (other_iter != o.roarings.cend() && other_iter->first < key) {
+                ++other_iter;
+            }
+            if (other_iter != o.roarings.cend() && other_iter->first == key) {
+                result.setRoaring(key, bitmap - other_iter->second);
+            } else {
+                result.setRoaring(key, Roaring(bitmap));
+            }
+        }
+        return result;
     }
 
     /**
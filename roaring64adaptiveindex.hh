@@ -0,0 +1,128 @@
+// Roaring64AdaptiveIndex: 按写入时观察到的不同值个数，在等值编码(Roaring64EqIndex)与位切片编码(Roaring64Bsi)
+// 之间选择，对外提供相同的查询接口。
+
+#ifndef INCLUDE_ROARING_64_ADAPTIVE_INDEX_HH_
+#define INCLUDE_ROARING_64_ADAPTIVE_INDEX_HH_
+
+#include <memory>
+#include <span>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include "roaring.hh"
+#include "roaring64bsi.hh"
+#include "roaring64eqindex.hh"
+
+namespace roaring {
+
+class Roaring64AdaptiveIndex {
+    using Roaring64MapPtr = std::unique_ptr<Roaring64Map>;
+
+public:
+    /**
+   * bsi_adaptive: 不同值的个数不超过 maxDistinct 时使用等值编码；一次写入使其超过 maxDistinct 时，
+   * 在写入前把已有的行转换为BSI，之后一直使用BSI，不再转换回等值编码。
+   */
+    explicit Roaring64AdaptiveIndex(size_t maxDistinct = defaultMaxDistinct)
+            : maxDistinct_ {maxDistinct} {}
+
+    void setValue(uint64_t columnId, uint64_t value) {
+        if (eqIndex_ != nullptr && eqIndex_->getBitmap(value) == nullptr &&
+            eqIndex_->distinctCount() >= maxDistinct_) {
+            switchToBsi();
+        }
+        if (eqIndex_ != nullptr) {
+            eqIndex_->setValue(columnId, value);
+        } else {
+            bsi_->setValue(columnId, value);
+        }
+    }
+
+    void setValues(const std::vector<std::tuple<uint64_t, uint64_t>>& vec) {
+        if (eqIndex_ != nullptr && exceedsMaxDistinct(vec)) {
+            switchToBsi();
+        }
+        if (eqIndex_ != nullptr) {
+            eqIndex_->setValues(vec);
+        } else {
+            bsi_->setValues(vec);
+        }
+    }
+
+    /**
+   * bsi_adaptive_is_equality: 当前是否为等值编码。
+   */
+    [[nodiscard]] auto isEqualityEncoded() const -> bool { return eqIndex_ != nullptr; }
+
+    // 当前编码的索引，另一个为 nullptr
+    [[nodiscard]] auto getEqIndex() const -> const Roaring64EqIndex* { return eqIndex_.get(); }
+    [[nodiscard]] auto getBsi() const -> const Roaring64Bsi* { return bsi_.get(); }
+
+    [[nodiscard]] auto getValue(uint64_t columnId) const noexcept -> std::tuple<uint64_t, bool> {
+        return eqIndex_ != nullptr ? eqIndex_->getValue(columnId) : bsi_->getValue(columnId);
+    }
+
+    [[nodiscard]] auto getExistenceBitmap() const -> const Roaring64Map& {
+        return eqIndex_ != nullptr ? eqIndex_->getExistenceBitmap() : bsi_->getExistenceBitmap();
+    }
+
+    [[nodiscard]] auto compare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                               const Roaring64Map* foundSet = nullptr) const -> Roaring64MapPtr {
+        return eqIndex_ != nullptr ? eqIndex_->compare(operation, startOrValue, end, foundSet)
+                                   : bsi_->compare(operation, startOrValue, end, foundSet);
+    }
+
+    [[nodiscard]] auto countCompare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                    const Roaring64Map* foundSet = nullptr) const -> uint64_t {
+        return eqIndex_ != nullptr ? eqIndex_->countCompare(operation, startOrValue, end, foundSet)
+                                   : bsi_->countCompare(operation, startOrValue, end, foundSet);
+    }
+
+    [[nodiscard]] auto compareIn(std::span<const uint64_t> values,
+                                 const Roaring64Map* foundSet = nullptr) const -> Roaring64MapPtr {
+        return eqIndex_ != nullptr ? eqIndex_->compareIn(values, foundSet)
+                                   : bsi_->compareIn(values, foundSet);
+    }
+
+    [[nodiscard]] auto sum(const Roaring64Map* foundSet) const
+            -> std::tuple<unsigned __int128, uint64_t> {
+        return eqIndex_ != nullptr ? eqIndex_->sum(foundSet) : bsi_->sum(foundSet);
+    }
+
+    [[nodiscard]] auto topK(uint64_t k, const Roaring64Map* foundSet = nullptr) const
+            -> Roaring64MapPtr {
+        return eqIndex_ != nullptr ? eqIndex_->topK(k, foundSet) : bsi_->topK(k, foundSet);
+    }
+
+private:
+    // whether writing 'vec' would leave more than maxDistinct_ values; stops counting there
+    [[nodiscard]] auto exceedsMaxDistinct(
+            const std::vector<std::tuple<uint64_t, uint64_t>>& vec) const -> bool {
+        std::unordered_set<uint64_t> added;
+        for (const auto& [columnId, value] : vec) {
+            if (eqIndex_->getBitmap(value) == nullptr && added.insert(value).second &&
+                eqIndex_->distinctCount() + added.size() > maxDistinct_) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void switchToBsi() {
+        bsi_ = eqIndex_->toBsi();
+        eqIndex_.reset();
+    }
+
+    size_t maxDistinct_;
+    std::unique_ptr<Roaring64EqIndex> eqIndex_ {std::make_unique<Roaring64EqIndex>()};
+    std::unique_ptr<Roaring64Bsi> bsi_;
+
+    // a range query on the equality index unions one bitmap per matching value, a BSI scans at
+    // most 64 slices whatever the number of values
+    constexpr static size_t defaultMaxDistinct {64};
+};
+
+} // namespace roaring
+
+#endif /*INCLUDE_ROARING_64_ADAPTIVE_INDEX_HH_*/
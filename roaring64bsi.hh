@@ -6,15 +6,28 @@
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bit>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <span>
 #include <sstream>
+#include <stdexcept>
+#include <string_view>
 #include <tuple>
 #include <vector>
 
 #include "roaring.hh"
+#include "threadpool.hh"
 
 namespace roaring {
 
@@ -29,9 +42,83 @@ enum BsiOperation {
     UNKNOWN = 100
 };
 
+class Roaring64RangeBsi;
+class Roaring64EqIndex;
+
 class Roaring64Bsi {
+    // the other encodings share the compare helpers; the range one converts the slices directly
+    friend class Roaring64RangeBsi;
+    friend class Roaring64EqIndex;
+
     using Roaring64MapPtr = std::unique_ptr<Roaring64Map>;
     using Roaring64BsiPtr = std::unique_ptr<Roaring64Bsi>;
+    // disjoint bitmaps whose union is a compare result
+    template <typename Bitmap>
+    using MatchedParts = std::vector<Bitmap>;
+
+    // slice accessors handed to the compare kernels: whole slices, or one 32-bit chunk of each
+    struct WholeSlices {
+        const Roaring64Bsi* bsi;
+        auto operator()(size_t i) const -> const Roaring64Map& { return bsi->slice(i); }
+    };
+    struct ChunkSlices {
+        std::vector<const Roaring*> chunks;
+        auto operator()(size_t i) const -> const Roaring& { return *chunks[i]; }
+    };
+    // frozen layout: header, then one section per bitmap (ebm first, then the slices)
+    struct FrozenHeader {
+        char magic[8];
+        uint64_t minValue;
+        uint64_t maxValue;
+        uint32_t flags;
+        uint32_t bitDepth;
+    };
+    struct FrozenSection {
+        uint64_t offset;
+        uint64_t length;
+    };
+    // versioned indexed layout: header, a directory entry per bitmap (ebm first, then the
+    // slices), then every bitmap in the portable Roaring64Map format
+    struct IndexedHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t bitDepth;
+        uint64_t minValue;
+        uint64_t maxValue;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+    struct IndexedSection {
+        uint64_t offset;
+        uint64_t length;
+        uint64_t cardinality;
+    };
+    // bounds of the values (query values; only widened by writes, so possibly loose), row count
+    // and sum of the stored values of one high-key chunk
+    struct ChunkZone {
+        uint32_t key;
+        uint64_t minValue;
+        uint64_t maxValue;
+        uint64_t cardinality;
+        unsigned __int128 storedSum;
+    };
+    // slices of an indexed buffer that are parsed by the first slice(i) needing them
+    struct LazySlices {
+        const char* buf;
+        std::vector<IndexedSection> sections;
+        std::vector<Roaring64Map> slices;
+        std::unique_ptr<std::once_flag[]> loaded;
+    };
+    // one bitmap of an addMany column: a slice of an input index, or a partial sum / carry
+    struct AddendSlice {
+        const Roaring64Map* input;
+        Roaring64Map owned;
+        [[nodiscard]] auto get() const -> const Roaring64Map& {
+            return input != nullptr ? *input : owned;
+        }
+    };
+    // 64 rows of values, or after transposeBlock 64 bit columns of 64 rows each
+    using BitBlock = std::array<uint64_t, 64>;
 
 public:
     [[nodiscard]] static std::string toUpperCase(std::string_view sv) noexcept {
@@ -77,7 +164,18 @@ public:
             : maxValue_ {other.maxValue_},
               minValue_ {other.minValue_},
               runOptimized_ {other.runOptimized_},
-              existenceBitMap_ {other.existenceBitMap_} {
+              deferMinMax_ {other.deferMinMax_},
+              minMaxDirty_ {other.minMaxDirty_.load()},
+              copyOnWrite_ {other.copyOnWrite_},
+              frameOfReference_ {other.frameOfReference_},
+              base_ {other.base_},
+              existenceBitMap_ {other.existenceBitMap_},
+              threadPool_ {other.threadPool_},
+              lazySlices_ {other.lazySlices_} {
+        if (other.copyOnWrite_) {
+            other.shareSlices();
+        }
+        sharedSlices_ = other.sharedSlices_;
         indexBitMapVec_.reserve(other.indexBitMapVec_.size());
         for (auto const& e : other.indexBitMapVec_) {
             indexBitMapVec_.emplace_back(e);
@@ -90,6 +188,10 @@ public:
         if (this != &other) {
             this->existenceBitMap_ = other.existenceBitMap_;
 
+            if (other.copyOnWrite_) {
+                other.shareSlices();
+            }
+            this->sharedSlices_ = other.sharedSlices_;
             this->indexBitMapVec_.clear();
             this->indexBitMapVec_.reserve(other.indexBitMapVec_.size());
             for (auto const& e : other.indexBitMapVec_) {
@@ -99,6 +201,15 @@ public:
             this->maxValue_ = other.maxValue_;
             this->minValue_ = other.minValue_;
             this->runOptimized_ = other.runOptimized_;
+            this->deferMinMax_ = other.deferMinMax_;
+            this->minMaxDirty_ = other.minMaxDirty_.load();
+            this->copyOnWrite_ = other.copyOnWrite_;
+            this->frameOfReference_ = other.frameOfReference_;
+            this->base_ = other.base_;
+            this->zones_.reset();
+            this->frozen_ = false;
+            this->threadPool_ = other.threadPool_;
+            this->lazySlices_ = other.lazySlices_;
         }
 
         return *this;
@@ -117,6 +228,16 @@ public:
             this->maxValue_ = other.maxValue_;
             this->minValue_ = other.minValue_;
             this->runOptimized_ = other.runOptimized_;
+            this->deferMinMax_ = other.deferMinMax_;
+            this->minMaxDirty_ = other.minMaxDirty_.load();
+            this->copyOnWrite_ = other.copyOnWrite_;
+            this->frameOfReference_ = other.frameOfReference_;
+            this->base_ = other.base_;
+            this->zones_.reset();
+            this->frozen_ = other.frozen_;
+            this->threadPool_ = std::move(other.threadPool_);
+            this->lazySlices_ = std::move(other.lazySlices_);
+            this->sharedSlices_ = std::move(other.sharedSlices_);
 
             other.clear();
         }
@@ -137,6 +258,16 @@ public:
             this->maxValue_ = other.maxValue_;
             this->minValue_ = other.minValue_;
             this->runOptimized_ = other.runOptimized_;
+            this->deferMinMax_ = other.deferMinMax_;
+            this->minMaxDirty_ = other.minMaxDirty_.load();
+            this->copyOnWrite_ = other.copyOnWrite_;
+            this->frameOfReference_ = other.frameOfReference_;
+            this->base_ = other.base_;
+            this->zones_.reset();
+            this->frozen_ = other.frozen_;
+            this->threadPool_ = std::move(other.threadPool_);
+            this->lazySlices_ = std::move(other.lazySlices_);
+            this->sharedSlices_ = std::move(other.sharedSlices_);
             other.clear();
         }
 
@@ -151,15 +282,17 @@ public:
     auto show() -> std::string {
         std::stringstream ss;
 
+        auto values = getValues(existenceBitMap_);
+        size_t i = 0;
         for (uint64_t columnId : existenceBitMap_) {
-            auto [value, exists] = getValue(columnId);
-            ss << fmt::format(" [{},{}] \n", columnId, value);
+            ss << fmt::format(" [{},{}] \n", columnId, values[i++]);
         }
 
         return ss.str();
     }
 
     auto toString() const -> std::string {
+        refreshMinMax();
         return fmt::format(
                 "Roaring64Bsi: minValue {}, maxValue {}, runOptimized {}, bit depth {}, "
                 "cardinality {}",
@@ -167,8 +300,99 @@ public:
                 existenceBitMap_.cardinality());
     }
 
+    /**
+   * 设置并行计算使用的线程池：compare/countCompare/sum/topK 按高32位分块并行，
+   * filter/exclude 按切片并行。传入 nullptr 恢复串行计算。clone() 得到的BSI共用同一线程池。
+   */
+    void setThreadPool(std::shared_ptr<ThreadPool> threadPool) {
+        threadPool_ = std::move(threadPool);
+    }
+
+    /**
+   * bsi_defer_min_max: 为 true 时 add/addMany 之后不立即重新计算min/max，只标记为过期，
+   * 由下一次用到min/max的操作(compare/countCompare/merge/序列化等)计算一次。适合连续多次 add 的计数场景。
+   */
+    void setDeferMinMax(bool deferMinMax) {
+        deferMinMax_ = deferMinMax;
+        if (!deferMinMax_) {
+            refreshMinMax();
+        }
+    }
+
+    /**
+   * bsi_frame_of_reference: 开启后切片存储 value - base 而不是 value 本身，位深只取决于值的跨度。
+   * 空索引上第一次写入时以写入的最小值为 base，之后写入更小的值会下调 base 并重新编码所有行，
+   * 下调时预留不小于当前跨度的余量，依次写入越来越小的值也只需重新编码 O(log n) 次；
+   * 已有数据时立即以当前最小值为 base 重新编码，关闭时恢复为 base 0。compare/sum/topK/getValue 等
+   * 接口的参数和结果仍是原始值，只有 getSlice 返回偏移后的切片。
+   */
+    void setFrameOfReference(bool frameOfReference) {
+        frameOfReference_ = frameOfReference;
+        if (!frameOfReference_) {
+            rebase(0);
+        } else if (!existenceBitMap_.isEmpty()) {
+            std::tie(minValue_, maxValue_) = minMaxValue();
+            minMaxDirty_ = false;
+            rebase(minValue_);
+        }
+    }
+
+    /**
+   * bsi_rebase: 以 base 重新编码所有行，切片存储 value - base；base 非 0 时开启 frame-of-reference。
+   * base 大于当前最小值时不做修改，返回 false。
+   */
+    auto rebase(uint64_t base) -> bool {
+        hydrate();
+        if (base > base_ && !existenceBitMap_.isEmpty()) {
+            refreshMinMax();
+            if (base > minValue_) {
+                // minValue_ may be a loose bound after overwrites
+                std::tie(minValue_, maxValue_) = minMaxValue();
+                if (base > minValue_) {
+                    return false;
+                }
+            }
+        }
+        frameOfReference_ = frameOfReference_ || base != 0;
+        if (base == base_) {
+            return true;
+        }
+        if (existenceBitMap_.isEmpty()) {
+            base_ = base;
+            return true;
+        }
+
+        // re-encode every row with the bulk decoder and loader
+        std::vector<uint64_t> columnIds(existenceBitMap_.cardinality());
+        existenceBitMap_.toUint64Array(columnIds.data());
+        auto values = getValues(existenceBitMap_);
+        const uint64_t maxValue = *std::max_element(values.begin(), values.end());
+        if (zones_ != nullptr) {
+            // every stored value moves by the change of base; the bounds are query values
+            for (auto& zone : *zones_) {
+                zone.storedSum += static_cast<unsigned __int128>(base_) * zone.cardinality;
+                zone.storedSum -= static_cast<unsigned __int128>(base) * zone.cardinality;
+            }
+        }
+        base_ = base;
+        indexBitMapVec_.clear();
+        grow(std::max(getBitDepth(maxValue - base_), 1UL));
+        appendSlices(columnIds, values);
+        return true;
+    }
+
+    /**
+   * bsi_base: frame-of-reference 的 base，切片存储 value - base；未开启时为 0。
+   */
+    [[nodiscard]] auto getBase() const -> uint64_t { return base_; }
+
     void setValue(uint64_t columnId, uint64_t value) {
         ensureCapacityInternal(value, value);
+        if (zones_ != nullptr) {
+            const auto [previous, exists] = getValue(columnId);
+            widenZone(zoneToWiden(static_cast<uint32_t>(columnId >> 32), value), value,
+                      exists ? std::optional<uint64_t>(previous) : std::nullopt);
+        }
         setValueInternal(columnId, value);
     }
 
@@ -176,18 +400,76 @@ public:
         if (vec.empty()) {
             return;
         }
-        uint64_t maxValue = std::get<1>(vec[0]);
-        uint64_t minValue = std::get<1>(vec[0]);
-        for (const auto& [columnId, value] : vec) {
-            minValue = std::min(minValue, value);
-            maxValue = std::max(maxValue, value);
+
+        auto byColumnId = [](const auto& left, const auto& right) {
+            return std::get<0>(left) < std::get<0>(right);
+        };
+        std::vector<std::tuple<uint64_t, uint64_t>> sorted;
+        const auto* rows = &vec;
+        if (!std::is_sorted(vec.begin(), vec.end(), byColumnId)) {
+            sorted = vec;
+            std::stable_sort(sorted.begin(), sorted.end(), byColumnId);
+            rows = &sorted;
+        }
+
+        // a later row for the same columnId overwrites the earlier ones, as with setValue
+        std::vector<uint64_t> columnIds;
+        std::vector<uint64_t> values;
+        columnIds.reserve(rows->size());
+        values.reserve(rows->size());
+        for (size_t i = 0; i < rows->size(); i++) {
+            const auto& [columnId, value] = (*rows)[i];
+            if (i + 1 < rows->size() && std::get<0>((*rows)[i + 1]) == columnId) {
+                continue;
+            }
+            columnIds.push_back(columnId);
+            values.push_back(value);
+        }
+        setValuesSorted(columnIds, values);
+    }
+
+    /**
+   * bsi_bulk_load: 批量设置按 columnId 严格递增排列的 (columnId, value)。每64行做一次位矩阵转置，
+   * 按切片收集置位的 columnId 后用 addMany 追加；空索引上不做 remove。
+   * columnIds 与 values 长度不一致或 columnIds 未严格递增时不做任何修改，返回 false。
+   */
+    auto setValuesSorted(std::span<const uint64_t> columnIds, std::span<const uint64_t> values)
+            -> bool {
+        if (columnIds.size() != values.size() ||
+            std::adjacent_find(columnIds.begin(), columnIds.end(), std::greater_equal<>()) !=
+                    columnIds.end()) {
+            return false;
+        }
+        if (columnIds.empty()) {
+            return true;
         }
 
-        ensureCapacityInternal(minValue, maxValue);
+        const bool fresh = existenceBitMap_.isEmpty();
+        auto [minValue, maxValue] = std::minmax_element(values.begin(), values.end());
+        ensureCapacityInternal(*minValue, *maxValue);
+
+        Roaring64Map ids;
+        ids.addMany(columnIds.size(), columnIds.data());
+        if (!existenceBitMap_.isEmpty()) {
+            // only rows that already hold a value need their old bits cleared
+            auto overwritten = existenceBitMap_ & ids;
+            if (zones_ != nullptr) {
+                widenZones(columnIds, values, overwritten);
+            }
+            if (!overwritten.isEmpty()) {
+                for (auto& slice : indexBitMapVec_) {
+                    slice -= overwritten;
+                }
+            }
+        }
+        existenceBitMap_ |= ids;
 
-        for (const auto& [columnId, value] : vec) {
-            setValueInternal(columnId, value);
+        appendSlices(columnIds, values);
+        if (fresh && (columnIds.front() >> 32) != (columnIds.back() >> 32)) {
+            // the rows are all there is, so the zones come from them without a slice scan
+            zones_ = zonesOf(columnIds, values);
         }
+        return true;
     }
 
     [[nodiscard]] auto getValue(uint64_t columnId) const noexcept -> std::tuple<uint64_t, bool> {
@@ -195,7 +477,32 @@ public:
             return std::make_tuple(0, false);
         }
 
-        return std::make_tuple(valueAt(columnId), true);
+        return std::make_tuple(valueAt(columnId) + base_, true);
+    }
+
+    /**
+   * bsi_get_values: 批量取值，按 columnId 升序返回 ids 中每个 columnId 的值，不在BSI中的 columnId 取 0。
+   * 每个切片只与 ids 归并遍历一次，每64个值一起转置得到，代替逐个 getValue。
+   */
+    [[nodiscard]] auto getValues(const Roaring64Map& ids) const -> std::vector<uint64_t> {
+        std::vector<uint64_t> values(ids.cardinality());
+        decodeInto(ids, values);
+        addBase(values);
+        return values;
+    }
+
+    /**
+   * bsi_decode_all: 按 columnId 升序将BSI中所有的值解码到 out，返回写入的个数。
+   * out 长度小于ebm的基数时不写入，返回 0。
+   */
+    auto decodeAll(std::span<uint64_t> out) const -> size_t {
+        const uint64_t count = existenceBitMap_.cardinality();
+        if (out.size() < count) {
+            return 0;
+        }
+        decodeInto(existenceBitMap_, out.first(count));
+        addBase(out.first(count));
+        return count;
     }
 
     /**
@@ -206,19 +513,145 @@ public:
             return;
         }
 
+        hydrate();
+        zones_.reset();
+        // rows on one side only keep their value, so disjoint indexes need no slice scan
+        const bool disjoint = !existenceBitMap_.intersect(otherBsi.existenceBitMap_);
+        if (disjoint) {
+            otherBsi.refreshMinMax();
+            if (existenceBitMap_.isEmpty()) {
+                minValue_ = otherBsi.minValue_;
+                maxValue_ = otherBsi.maxValue_;
+                minMaxDirty_ = false;
+            } else {
+                minValue_ = std::min(minValue_, otherBsi.minValue_);
+                maxValue_ = std::max(maxValue_, otherBsi.maxValue_);
+            }
+        }
+        std::vector<Roaring64Map> baseOffsets;
+        if (base_ != 0 || otherBsi.base_ != 0) {
+            baseOffsets = rebaseForAdd(otherBsi, disjoint);
+        }
         existenceBitMap_ |= otherBsi.existenceBitMap_;
 
-        if (otherBsi.bitCount() > bitCount()) {
-            grow(otherBsi.bitCount());
+        rippleAdd(otherBsi.bitCount(), WholeSlices {&otherBsi});
+        if (!baseOffsets.empty()) {
+            rippleAdd(baseOffsets.size(),
+                      [&baseOffsets](size_t i) -> const Roaring64Map& { return baseOffsets[i]; });
+        }
+
+        if (!disjoint) {
+            updateMinMax();
+        }
+    }
+
+    /**
+   * bsi_add_many: 将多个BSI的value加到当前BSI上，结果与依次调用 add 相同；others 中出现当前BSI本身时，
+   * 它每次都贡献调用前的value。按位权逐列做进位保留加法(Wallace树)：同一位权的切片两两相加，进位进入
+   * 下一位权，只在最后解析一次进位，min/max 也只计算一次。others 中的 nullptr 被忽略。
+   */
+    void addMany(std::span<const Roaring64Bsi* const> others) {
+        // an operand aliasing this index reads a snapshot of it, taken before the first write and
+        // before hydrate() as that may share the slices under copy-on-write
+        std::optional<Roaring64Bsi> snapshot;
+        std::vector<const Roaring64Bsi*> operands(others.begin(), others.end());
+        for (auto& operand : operands) {
+            if (operand == this) {
+                if (!snapshot.has_value()) {
+                    snapshot.emplace(*this);
+                }
+                operand = &*snapshot;
+            }
+        }
+
+        // the columns add stored values, which only line up when no operand has a base
+        auto hasBase = [](const Roaring64Bsi* other) {
+            return other != nullptr && other->base_ != 0;
+        };
+        if (base_ != 0 || std::any_of(operands.begin(), operands.end(), hasBase)) {
+            for (const auto* other : operands) {
+                if (other != nullptr) {
+                    add(*other);
+                }
+            }
+            return;
+        }
+
+        hydrate();
+        zones_.reset();
+
+        std::vector<const Roaring64Map*> existenceBitMaps {&existenceBitMap_};
+        size_t depth = bitCount();
+        for (const auto* other : operands) {
+            if (other != nullptr && !other->existenceBitMap_.isEmpty()) {
+                existenceBitMaps.push_back(&other->existenceBitMap_);
+                depth = std::max(depth, other->bitCount());
+            }
+        }
+        if (existenceBitMaps.size() == 1) {
+            return;
+        }
+
+        // columns[i] holds every bitmap of weight 2^i still to be added up
+        std::vector<std::deque<AddendSlice>> columns(depth);
+        for (size_t i = 0; i < bitCount(); i++) {
+            if (!indexBitMapVec_[i].isEmpty()) {
+                columns[i].push_back({nullptr, std::move(indexBitMapVec_[i])});
+            }
+        }
+        for (const auto* other : operands) {
+            if (other == nullptr) {
+                continue;
+            }
+            for (size_t i = 0; i < other->bitCount(); i++) {
+                if (!other->slice(i).isEmpty()) {
+                    columns[i].push_back({&other->slice(i), {}});
+                }
+            }
+        }
+
+        // half-add the bitmaps of a column pairwise, oldest first, so that every column reduces
+        // as a balanced tree; the carries join the next column
+        for (size_t i = 0; i < columns.size(); i++) {
+            while (columns[i].size() > 1) {
+                AddendSlice left = std::move(columns[i].front());
+                columns[i].pop_front();
+                AddendSlice right = std::move(columns[i].front());
+                columns[i].pop_front();
+
+                Roaring64Map carry = left.get() & right.get();
+                Roaring64Map sum = left.get() ^ right.get();
+                if (!sum.isEmpty()) {
+                    columns[i].push_back({nullptr, std::move(sum)});
+                }
+                if (!carry.isEmpty()) {
+                    if (i + 1 == columns.size()) {
+                        columns.emplace_back();
+                    }
+                    columns[i + 1].push_back({nullptr, std::move(carry)});
+                }
+            }
         }
 
-        for (size_t i = 0; i < otherBsi.bitCount(); i++) {
-            addDigit(otherBsi.indexBitMapVec_[i], i);
+        existenceBitMap_ =
+                Roaring64Map::fastunion(existenceBitMaps.size(), existenceBitMaps.data());
+        indexBitMapVec_.clear();
+        grow(columns.size());
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (!columns[i].empty()) {
+                auto& slice = columns[i].front();
+                if (slice.input != nullptr) {
+                    indexBitMapVec_[i] = *slice.input;
+                } else {
+                    indexBitMapVec_[i] = std::move(slice.owned);
+                }
+            }
+        }
+        while (bitCount() > 1 && indexBitMapVec_.back().isEmpty()) {
+            indexBitMapVec_.pop_back();
         }
 
-        // update min and max after adding
-        minValue_ = minValue();
-        maxValue_ = maxValue();
+        updateMinMax();
     }
 
     /**
@@ -233,36 +666,138 @@ public:
             return false; // Cannot merge if there is an intersection in existenceBitMap
         }
 
-        size_t bitDepth = std::max(indexBitMapVec_.size(), otherBsi.indexBitMapVec_.size());
+        hydrate();
+        zones_.reset();
+        // the slices can only be or-ed once both sides share one base
+        const Roaring64Bsi* other = &otherBsi;
+        std::optional<Roaring64Bsi> rebased;
+        if (base_ != otherBsi.base_) {
+            const uint64_t base = frameOfReference_ ? std::min(base_, otherBsi.base_) : 0;
+            rebase(base);
+            if (otherBsi.base_ != base) {
+                rebased.emplace(otherBsi);
+                rebased->rebase(base);
+                other = &*rebased;
+            }
+        }
+        size_t bitDepth = std::max(indexBitMapVec_.size(), other->bitCount());
 
-        indexBitMapVec_.resize(bitDepth);
+        grow(bitDepth);
 
         for (size_t i = 0; i < bitDepth; i++) {
-            if (i < otherBsi.indexBitMapVec_.size()) {
-                indexBitMapVec_[i] |= otherBsi.indexBitMapVec_[i];
+            if (i < other->bitCount()) {
+                indexBitMapVec_[i] |= other->slice(i);
             }
-            if (runOptimized_ || otherBsi.runOptimized_) {
+            if (runOptimized_ || other->runOptimized_) {
                 indexBitMapVec_[i].runOptimize();
             }
         }
 
-        existenceBitMap_ |= otherBsi.existenceBitMap_;
-        runOptimized_ = runOptimized_ || otherBsi.runOptimized_;
-        maxValue_ = std::max(maxValue_, otherBsi.maxValue_);
-        minValue_ = std::min(minValue_, otherBsi.minValue_);
+        existenceBitMap_ |= other->existenceBitMap_;
+        runOptimized_ = runOptimized_ || other->runOptimized_;
+        refreshMinMax();
+        other->refreshMinMax();
+        maxValue_ = std::max(maxValue_, other->maxValue_);
+        minValue_ = std::min(minValue_, other->minValue_);
         return true;
     }
 
     /**
    * bsi_sum: 返回BSI value之和sum以及ebm基数cardinality组成的数组。
    * 如果有第二入参roaringbitmap为非空，则先查询BSI的ebm和bytea的交集部分，再计算sum与基数。
+   * sum 以 128 位返回，全部为 64 位最大值的 2^64 行也不会溢出；不会溢出 64 位时按 64 位累加。
    */
-    [[nodiscard]] auto sum(const Roaring64Map* foundSet) const -> std::tuple<uint64_t, uint64_t> {
+    [[nodiscard]] auto sum(const Roaring64Map* foundSet) const
+            -> std::tuple<unsigned __int128, uint64_t> {
         if (foundSet != nullptr) [[likely]] {
-            return sumInternal(*foundSet);
+            auto [sum, count] = sumInternal(*foundSet);
+            sum += static_cast<unsigned __int128>(base_) * count;
+            return std::make_tuple(sum, count);
+        }
+
+        // every slice is a subset of the ebm: the slice cardinalities are enough
+        const uint64_t count = existenceBitMap_.cardinality();
+        const unsigned __int128 sum =
+                weightedSum(bitCount(), count, [&](size_t i) { return getSliceCardinality(i); });
+        return std::make_tuple(sum + static_cast<unsigned __int128>(base_) * count, count);
+    }
+
+    /**
+   * bsi_group_sum: 对每个分组位图(为空指针时为全部行)返回与 sum 相同的 (value之和, 行数)。
+   * 按高32位分块处理，每个分块的每个切片只访问一次：分组少时与所有分组求交集基数，分组多时先把分块
+   * 按 2^16 行一段解码为value再按各分组的行累加。有线程池时各分块并行。
+   */
+    [[nodiscard]] auto groupSum(std::span<const Roaring64Map* const> groups) const
+            -> std::vector<std::tuple<unsigned __int128, uint64_t>> {
+        std::vector<std::pair<uint32_t, const Roaring*>> chunks;
+        for (const auto& [key, chunk] : existenceBitMap_.getRoarings()) {
+            if (!chunk.isEmpty()) {
+                chunks.emplace_back(key, &chunk);
+            }
+        }
+        auto zones = usesZones() ? chunkZones() : nullptr;
+        std::vector<std::vector<std::tuple<unsigned __int128, uint64_t>>> chunkSums(chunks.size());
+        forEachChunk(chunks.size(), [&](size_t c) {
+            const auto [key, chunk] = chunks[c];
+            chunkSums[c] = groupSumOfChunk(key, *chunk, groups,
+                                           zones != nullptr ? zoneOf(*zones, key) : nullptr);
+        });
+
+        std::vector<std::tuple<unsigned __int128, uint64_t>> sums(groups.size());
+        for (const auto& chunkSum : chunkSums) {
+            for (size_t g = 0; g < groups.size(); g++) {
+                std::get<0>(sums[g]) += std::get<0>(chunkSum[g]);
+                std::get<1>(sums[g]) += std::get<1>(chunkSum[g]);
+            }
+        }
+        for (auto& [sum, count] : sums) {
+            sum += static_cast<unsigned __int128>(base_) * count;
+        }
+        return sums;
+    }
+
+    /**
+   * bsi_sum_of_squares: 返回 foundSet(为空指针时为全部行)中有值的行的value平方和与行数，不解码value：
+   * 平方和是 Σ 2^(i+j)·|S_i ∩ S_j ∩ foundSet|，两两切片交集的基数在线程池上并行计算。
+   * 按 128 位累加，平方和超过 2^128 时回绕。
+   */
+    [[nodiscard]] auto sumOfSquares(const Roaring64Map* foundSet) const
+            -> std::tuple<unsigned __int128, uint64_t> {
+        const auto [squares, sum, count] = storedMoments(foundSet);
+        // (x + base)^2 summed over the rows, x being the stored value
+        const auto base = static_cast<unsigned __int128>(base_);
+        return std::make_tuple(squares + 2 * base * sum + base * base * count, count);
+    }
+
+    /**
+   * bsi_variance: 返回 foundSet(为空指针时为全部行)中有值的行的value的总体方差
+   * Σ(v - mean)^2 / n，由 sum 与 sumOfSquares 在 128 位整数中围绕均值精确中心化后得到，
+   * value 很大而离散很小时也不损失精度；没有行时返回 (0, false)。
+   */
+    [[nodiscard]] auto variance(const Roaring64Map* foundSet) const -> std::tuple<double, bool> {
+        // the variance does not depend on the frame of reference: the stored values are enough
+        const auto [squares, sum, count] = storedMoments(foundSet);
+        if (count == 0) {
+            return std::make_tuple(0.0, false);
         }
+        // centred on the integer part s of the mean, Σ(x - s)^2 = Σx^2 - 2sΣx + n·s^2 and
+        // Σ(x - s) = Σx - n·s are exact in wrapping 128-bit arithmetic, and the latter is below n:
+        // only these small moments go to floating point, so nothing cancels there
+        const unsigned __int128 shift = sum / count;
+        const unsigned __int128 deviations = sum - shift * count;
+        const unsigned __int128 centred = squares - 2 * shift * sum + shift * shift * count;
+        const auto n = static_cast<long double>(count);
+        const auto d = static_cast<long double>(deviations);
+        const long double variance = (static_cast<long double>(centred) - d * d / n) / n;
+        return std::make_tuple(static_cast<double>(std::max(variance, 0.0L)), true);
+    }
 
-        return sumInternal(this->existenceBitMap_);
+    /**
+   * bsi_stddev: 返回 foundSet(为空指针时为全部行)中有值的行的value的总体标准差，即 variance 的平方根。
+   */
+    [[nodiscard]] auto stddev(const Roaring64Map* foundSet) const -> std::tuple<double, bool> {
+        const auto [variance, exists] = this->variance(foundSet);
+        return std::make_tuple(std::sqrt(variance), exists);
     }
 
     /**
@@ -277,31 +812,20 @@ public:
             return std::make_unique<Roaring64Bsi>();
         }
 
-        auto newBsiPtr = clone();
-
-        newBsiPtr->existenceBitMap_ &= *foundSetPtr;
-        for (size_t i = 0; i < newBsiPtr->bitCount(); i++) {
-            newBsiPtr->indexBitMapVec_[i] &= *foundSetPtr;
-        }
-
-        return newBsiPtr;
+        return derive(existenceBitMap_ & *foundSetPtr,
+                      [foundSetPtr](const Roaring64Map& slice) { return slice & *foundSetPtr; });
     }
 
     /**
    * bsi_exclude: 查询BSI的ebm中剔除指定用户 foundSet，返回新的BSI。
    */
     [[nodiscard]] auto exclude(const Roaring64Map* foundSetPtr) const -> Roaring64BsiPtr {
-        auto newBsiPtr = clone();
         if (foundSetPtr == nullptr || (*foundSetPtr).isEmpty()) {
-            return newBsiPtr;
-        }
-
-        newBsiPtr->existenceBitMap_ -= *foundSetPtr;
-        for (size_t i = 0; i < newBsiPtr->bitCount(); i++) {
-            newBsiPtr->indexBitMapVec_[i] -= *foundSetPtr;
+            return clone();
         }
 
-        return newBsiPtr;
+        return derive(existenceBitMap_ - *foundSetPtr,
+                      [foundSetPtr](const Roaring64Map& slice) { return slice - *foundSetPtr; });
     }
 
     /**
@@ -311,6 +835,26 @@ public:
         return existenceBitMap_;
     }
 
+    /**
+   * bsi_slice: 查询BSI第i个bit位切片的roaringbitmap。
+   */
+    [[nodiscard]] auto getSlice(size_t i) const -> const Roaring64Map& {
+        if (i >= bitCount()) {
+            throw std::out_of_range(fmt::format("slice {} out of range", i));
+        }
+        return slice(i);
+    }
+
+    /**
+   * bsi_slice_cardinality: 查询BSI第i个bit位切片的基数，延迟加载的切片直接读取段目录，不解析切片。
+   */
+    [[nodiscard]] auto getSliceCardinality(size_t i) const -> uint64_t {
+        if (lazySlices_ != nullptr) {
+            return lazySlices_->sections[i].cardinality;
+        }
+        return slice(i).cardinality();
+    }
+
     [[nodiscard]] auto valueExist(uint64_t columnId) const noexcept -> bool {
         return existenceBitMap_.contains(columnId);
     }
@@ -322,47 +866,203 @@ public:
    */
     [[nodiscard]] auto compare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
                                const Roaring64Map* foundSet = nullptr) const -> Roaring64MapPtr {
-        auto compareResult = compareUsingMinMax(operation, startOrValue, end, foundSet);
-
-        if (compareResult) {
-            return compareResult;
+        if (!isCompareOperation(operation)) {
+            return nullptr;
         }
 
-        switch (operation) {
-        case EQ:
-            return oNeilCompare(operation, startOrValue, foundSet);
-        case NEQ:
-            return oNeilCompare(operation, startOrValue, foundSet);
-        case GE:
-            return oNeilCompare(operation, startOrValue, foundSet);
-        case GT:
-            return oNeilCompare(operation, startOrValue, foundSet);
-        case LT:
-            return oNeilCompare(operation, startOrValue, foundSet);
-        case LE:
-            return oNeilCompare(operation, startOrValue, foundSet);
-        case RANGE: {
-            if (startOrValue < minValue_) {
-                startOrValue = minValue_;
+        auto allMatch = compareUsingMinMax(operation, startOrValue, end);
+        if (allMatch.has_value()) {
+            if (!*allMatch) {
+                return std::make_unique<Roaring64Map>();
             }
+            return std::make_unique<Roaring64Map>(
+                    foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_);
+        }
+
+        Roaring64Map filteredCandidates;
+        auto [candidates, lateFilter] = compareScope(foundSet, filteredCandidates);
+        if (usesZones()) {
+            return std::make_unique<Roaring64Map>(
+                    chunkedCompare(operation, startOrValue, end, *candidates, lateFilter));
+        }
+
+        toStoredPredicate(operation, startOrValue, end);
+        return std::make_unique<Roaring64Map>(compareBitmap(operation, startOrValue, end,
+                                                            *candidates, lateFilter,
+                                                            wholeSlices()));
+    }
+
+    /**
+   * 对BSI进行比较过滤查询，只返回满足条件的个数。
+   * 等价于 compare(...)->cardinality()，但不生成结果bitmap。
+   */
+    [[nodiscard]] auto countCompare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                    const Roaring64Map* foundSet = nullptr) const -> uint64_t {
+        if (!isCompareOperation(operation)) {
+            return 0;
+        }
 
-            if (end > maxValue_) {
-                end = maxValue_;
+        auto allMatch = compareUsingMinMax(operation, startOrValue, end);
+        if (allMatch.has_value()) {
+            if (!*allMatch) {
+                return 0;
             }
+            return foundSet != nullptr ? existenceBitMap_.and_cardinality(*foundSet)
+                                       : existenceBitMap_.cardinality();
+        }
+
+        Roaring64Map filteredCandidates;
+        auto [candidates, lateFilter] = compareScope(foundSet, filteredCandidates);
+        if (usesZones()) {
+            return chunkedCount(operation, startOrValue, end, *candidates, lateFilter);
+        }
 
-            auto left = oNeilCompare(BsiOperation::GE, startOrValue, foundSet);
-            auto right = oNeilCompare(BsiOperation::LE, end, foundSet);
+        toStoredPredicate(operation, startOrValue, end);
+        return countBitmap(operation, startOrValue, end, *candidates, lateFilter, wholeSlices());
+    }
 
-            if (left && right) {
-                return std::make_unique<Roaring64Map>(*left & *right);
+    /**
+   * bsi_compare_in: 值属于 values 的行(IN 列表)，foundSet 非空时只在其中选取。values 排序去重后
+   * 看作按位展开的二叉树，自高位向低位遍历切片，共享高位前缀的值只计算一次。
+   */
+    [[nodiscard]] auto compareIn(std::span<const uint64_t> values,
+                                 const Roaring64Map* foundSet = nullptr) const -> Roaring64MapPtr {
+        refreshMinMax();
+        // values outside [minValue_, maxValue_] match nothing; the rest move to the stored domain
+        std::vector<uint64_t> stored;
+        stored.reserve(values.size());
+        for (auto value : values) {
+            if (value >= minValue_ && value <= maxValue_ &&
+                getBitDepth(value - base_) <= bitCount()) {
+                stored.push_back(value - base_);
             }
-            return nullptr;
         }
-        default:
-            return nullptr;
+        std::sort(stored.begin(), stored.end());
+        stored.erase(std::unique(stored.begin(), stored.end()), stored.end());
+        if (stored.empty() || existenceBitMap_.isEmpty()) {
+            return std::make_unique<Roaring64Map>();
+        }
+
+        Roaring64Map filteredCandidates;
+        auto [candidates, lateFilter] = compareScope(foundSet, filteredCandidates);
+        if (usesZones()) {
+            return std::make_unique<Roaring64Map>(chunkedIn(stored, *candidates, lateFilter));
+        }
+
+        MatchedParts<Roaring64Map> parts;
+        inTrie(*candidates, std::span<const uint64_t>(stored),
+               static_cast<int32_t>(bitCount()) - 1, wholeSlices(), parts);
+        auto matched = std::make_unique<Roaring64Map>(unionOf(std::move(parts)));
+        if (lateFilter != nullptr) {
+            *matched &= *lateFilter;
+        }
+        return matched;
+    }
+
+    /**
+   * bsi_histogram: 按严格递增的分界点 boundaries 统计各区间的行数，返回 boundaries.size() + 1 个计数：
+   * 第0个为 value < boundaries[0]，第i个为 boundaries[i-1] <= value < boundaries[i]，最后一个为
+   * value >= boundaries.back()。foundSet 非空时只统计其中的行。自高位向低位按切片二分，整棵子树落在
+   * 同一区间时只取基数，一次遍历得到所有区间。boundaries 未严格递增时返回空数组。
+   */
+    [[nodiscard]] auto histogram(std::span<const uint64_t> boundaries,
+                                 const Roaring64Map* foundSet = nullptr) const
+            -> std::vector<uint64_t> {
+        if (std::adjacent_find(boundaries.begin(), boundaries.end(), std::greater_equal<>()) !=
+            boundaries.end()) {
+            return {};
+        }
+
+        // value >= boundary holds for every row when boundary <= base_, so such a boundary is 0
+        // in the stored domain
+        std::vector<uint64_t> stored(boundaries.size());
+        std::transform(boundaries.begin(), boundaries.end(), stored.begin(), [this](uint64_t b) {
+            return b > base_ ? b - base_ : 0;
+        });
+        std::vector<uint64_t> counts(boundaries.size() + 1);
+        Roaring64Map rows = foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_;
+        if (usesZones()) {
+            chunkedHistogram(stored, rows, counts);
+        } else {
+            const uint64_t cardinality = rows.cardinality();
+            histogramNode(std::move(rows), cardinality, 0, static_cast<int32_t>(bitCount()) - 1,
+                          stored, wholeSlices(), counts);
+        }
+        return counts;
+    }
+
+    /**
+   * bsi_kth_value: 返回 foundSet(为空指针时为全部行)中有值的行里第 rank 小(从0开始)的value。
+   * 自高位向低位每个切片做一次 and_cardinality 决定该位，再原地缩小候选行，不解码任何值。
+   * rank 不小于行数时返回 (0, false)。
+   */
+    [[nodiscard]] auto kthValue(uint64_t rank, const Roaring64Map* foundSet = nullptr) const
+            -> std::tuple<uint64_t, bool> {
+        Roaring64Map candidates =
+                foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_;
+        const uint64_t count = candidates.cardinality();
+        if (rank >= count) {
+            return std::make_tuple(0, false);
+        }
+        return std::make_tuple(kthStoredValue(candidates, count, rank) + base_, true);
+    }
+
+    /**
+   * bsi_quantile: 返回 foundSet(为空指针时为全部行)中有值的行的 q 分位数(0 <= q <= 1)，按最近秩
+   * (nearest-rank)取第 ceil(q * n) 小的值：q = 0 为最小值，q = 0.5 为(下)中位数，q = 1 为最大值。
+   * q 不在 [0, 1] 内或没有行时返回 (0, false)。
+   */
+    [[nodiscard]] auto quantile(double q, const Roaring64Map* foundSet = nullptr) const
+            -> std::tuple<uint64_t, bool> {
+        if (!(q >= 0 && q <= 1)) {
+            return std::make_tuple(0, false);
+        }
+        Roaring64Map candidates =
+                foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_;
+        const uint64_t count = candidates.cardinality();
+        if (count == 0) {
+            return std::make_tuple(0, false);
         }
+        const auto nearestRank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(count)));
+        const uint64_t rank = std::clamp<uint64_t>(nearestRank, 1, count) - 1;
+        return std::make_tuple(kthStoredValue(candidates, count, rank) + base_, true);
+    }
+
+    /**
+   * bsi_min: 返回 foundSet(为空指针时为全部行)中有值的行的最小value，没有行时返回 (0, false)。
+   */
+    [[nodiscard]] auto min(const Roaring64Map* foundSet = nullptr) const
+            -> std::tuple<uint64_t, bool> {
+        auto [value, rows] = argMin(foundSet);
+        return std::make_tuple(value, !rows->isEmpty());
+    }
+
+    /**
+   * bsi_max: 返回 foundSet(为空指针时为全部行)中有值的行的最大value，没有行时返回 (0, false)。
+   */
+    [[nodiscard]] auto max(const Roaring64Map* foundSet = nullptr) const
+            -> std::tuple<uint64_t, bool> {
+        auto [value, rows] = argMax(foundSet);
+        return std::make_tuple(value, !rows->isEmpty());
+    }
+
+    /**
+   * bsi_arg_min: 返回 foundSet(为空指针时为全部行)中有值的行的最小value与取到它的全部行。
+   * 自高位向低位原地缩小候选行，候选行落在同一个高32位分块后只在这个分块上继续，只剩一行时直接取值。
+   * 没有行时返回 (0, 空位图)。
+   */
+    [[nodiscard]] auto argMin(const Roaring64Map* foundSet = nullptr) const
+            -> std::tuple<uint64_t, Roaring64MapPtr> {
+        return extremeOf(foundSet, false);
+    }
 
-        return nullptr;
+    /**
+   * bsi_arg_max: 返回 foundSet(为空指针时为全部行)中有值的行的最大value与取到它的全部行，
+   * 同 argMin。没有行时返回 (0, 空位图)。
+   */
+    [[nodiscard]] auto argMax(const Roaring64Map* foundSet = nullptr) const
+            -> std::tuple<uint64_t, Roaring64MapPtr> {
+        return extremeOf(foundSet, true);
     }
 
     /**
@@ -385,6 +1085,13 @@ public:
             }
             candidates = std::make_unique<Roaring64Map>(*foundSet & getExistenceBitmap());
         }
+        if (usesZones()) {
+            pruneTopKChunks(k, *candidates);
+        }
+
+        if (runsParallel(candidates->getRoarings().size())) {
+            return parallelTopK(k, *candidates);
+        }
 
         if (k >= candidates->cardinality()) {
             return candidates;
@@ -395,16 +1102,20 @@ public:
         // keep target K value
         size_t originalTargetTopK = k;
 
-        for (int32_t x = bitCount() - 1; x >= 0 && !candidates->isEmpty() && k > 0; x--) {
-            Roaring64Map andBitmap = *candidates;
-            andBitmap &= indexBitMapVec_[x];
-            uint64_t cardinality = andBitmap.cardinality();
-
+        uint64_t remaining = candidates->cardinality();
+        for (int32_t x = bitCount() - 1; x >= 0 && remaining > 0 && k > 0; x--) {
+            const auto& slice = this->slice(x);
+            // counted without materializing the intersection, which is only built when taken
+            const uint64_t cardinality = candidates->and_cardinality(slice);
             if (cardinality > k) {
-                *candidates &= indexBitMapVec_[x];
-            } else {
-                *retBitmap |= andBitmap;
-                *candidates -= indexBitMapVec_[x];
+                if (cardinality < remaining) {
+                    *candidates &= slice;
+                }
+                remaining = cardinality;
+            } else if (cardinality > 0) {
+                *retBitmap |= *candidates & slice;
+                *candidates -= slice;
+                remaining -= cardinality;
                 k -= cardinality;
             }
         }
@@ -434,15 +1145,12 @@ public:
         const Roaring64Map& fixedFoundSet =
                 foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_;
 
-        Roaring64MapPtr retBitmap = std::make_unique<Roaring64Map>();
-
-        std::for_each(fixedFoundSet.begin(), fixedFoundSet.end(),
-                      [&retBitmap, this](auto const it) {
-                          const auto& [value, exists] = getValue(it);
-
-                          retBitmap->add(value);
-                      });
+        auto values = getValues(fixedFoundSet);
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
 
+        Roaring64MapPtr retBitmap = std::make_unique<Roaring64Map>();
+        retBitmap->addMany(values.size(), values.data());
         return retBitmap;
     }
 
@@ -457,16 +1165,19 @@ public:
 
         Roaring64BsiPtr retBsi = std::make_unique<Roaring64Bsi>();
 
-        std::for_each(fixedFoundSet.begin(), fixedFoundSet.end(), [&retBsi, this](auto const it) {
-            const auto& [value, exists] = getValue(it);
-            const auto& [reValue, reExists] = retBsi->getValue(value);
+        if (fixedFoundSet.isEmpty()) {
+            return retBsi;
+        }
 
-            if (reExists) {
-                retBsi->setValue(value, reValue + 1);
-            } else {
-                retBsi->setValue(value, 1);
-            }
-        });
+        std::vector<uint64_t> values;
+        std::vector<uint64_t> counts;
+        if (bitCount() <= histogramPartitionDepth) {
+            partitionHistogram(fixedFoundSet, bitCount(), 0, values, counts);
+        } else {
+            sortedHistogram(fixedFoundSet, values, counts);
+        }
+        addBase(values);
+        retBsi->setValuesSorted(values, counts);
 
         return retBsi;
     }
@@ -479,22 +1190,27 @@ public:
 
     auto serializedSizeInBytes() const -> uint64_t {
         uint64_t size = 0;
-        for (const auto& rb : indexBitMapVec_) {
-            size += rb.getSizeInBytes();
+        for (size_t i = 0; i < bitCount(); i++) {
+            size += slice(i).getSizeInBytes();
         }
 
-        return 8 + 8 + 1 + existenceBitMap_.getSizeInBytes() + 4 + size;
+        return 8 + 8 + 1 + baseSize() + existenceBitMap_.getSizeInBytes() + 4 + size;
     }
 
     auto serialize(char* buf) const -> size_t {
+        refreshMinMax();
         const char* orig = buf;
-        uint8_t opt = runOptimized_ ? 1 : 0;
+        uint8_t opt = (runOptimized_ ? 1 : 0) | (frameOfReference_ ? frameOfReferenceFlag : 0);
         std::memcpy(buf, &minValue_, sizeof(uint64_t));
         buf += sizeof(uint64_t);
         std::memcpy(buf, &maxValue_, sizeof(uint64_t));
         buf += sizeof(uint64_t);
         std::memcpy(buf, &opt, sizeof(uint8_t));
         buf += sizeof(uint8_t);
+        if (frameOfReference_) {
+            std::memcpy(buf, &base_, sizeof(uint64_t));
+            buf += sizeof(uint64_t);
+        }
 
         // write ebM
         auto ebMSize = existenceBitMap_.getSizeInBytes();
@@ -507,7 +1223,8 @@ public:
         buf += sizeof(uint32_t);
 
         // write bA
-        for (const auto& rb : indexBitMapVec_) {
+        for (size_t i = 0; i < bitCount(); i++) {
+            const auto& rb = slice(i);
             auto rbSize = rb.getSizeInBytes();
             rb.write(buf);
             buf += rbSize;
@@ -529,8 +1246,11 @@ public:
         std::memcpy(&opt, buf, sizeof(uint8_t));
         buf += sizeof(uint8_t);
 
-        if (opt == 1) {
-            runOptimized_ = true;
+        runOptimized_ = (opt & 1) != 0;
+        if ((opt & frameOfReferenceFlag) != 0) {
+            frameOfReference_ = true;
+            std::memcpy(&base_, buf, sizeof(uint64_t));
+            buf += sizeof(uint64_t);
         }
 
         // read ebM
@@ -549,15 +1269,197 @@ public:
             size_t baSize = indexBitMapVec_[i].getSizeInBytes();
             buf += baSize;
         }
-    }
-
-    void runOptimize() {
-        existenceBitMap_.runOptimize();
-
-        for (auto& bmPtr : indexBitMapVec_) {
-            bmPtr.runOptimize();
+        if ((opt & rangeEncodedFlag) != 0) {
+            // a Roaring64RangeBsi slice holds the rows whose bit is clear
+            for (auto& slice : indexBitMapVec_) {
+                slice = existenceBitMap_ - slice;
+            }
         }
-        runOptimized_ = true;
+    }
+
+    /**
+   * bsi_frozen_size: writeFrozen 需要的字节数。
+   */
+    [[nodiscard]] auto frozenSizeInBytes() const -> size_t {
+        auto sections = frozenSections();
+        return sections.back().offset + sections.back().length;
+    }
+
+    /**
+   * bsi_write_frozen: 按冻结格式写出BSI：32字节的头部(开启 frame-of-reference 时后跟8字节的 base)、
+   * 段偏移表，以及32字节对齐的ebm和各切片(Roaring64Map::writeFrozen)。buf 必须按32字节对齐，
+   * 返回写入的字节数。
+   */
+    auto writeFrozen(char* buf) const -> size_t {
+        auto sections = frozenSections();
+        const size_t size = sections.back().offset + sections.back().length;
+        std::memset(buf, 0, size);
+        refreshMinMax();
+
+        FrozenHeader header {};
+        std::memcpy(header.magic, frozenMagic.data(), frozenMagic.size());
+        header.minValue = minValue_;
+        header.maxValue = maxValue_;
+        header.flags = (runOptimized_ ? 1 : 0) | (frameOfReference_ ? frameOfReferenceFlag : 0);
+        header.bitDepth = indexBitMapVec_.size();
+        std::memcpy(buf, &header, sizeof(header));
+        std::memcpy(buf + sizeof(header), &base_, baseSize());
+        std::memcpy(buf + sizeof(header) + baseSize(), sections.data(),
+                    sections.size() * sizeof(FrozenSection));
+
+        existenceBitMap_.writeFrozen(buf + sections[0].offset);
+        for (size_t i = 0; i < bitCount(); i++) {
+            slice(i).writeFrozen(buf + sections[i + 1].offset);
+        }
+        return size;
+    }
+
+    /**
+   * bsi_frozen_view: 直接在 writeFrozen 写出的内存(例如 mmap 的文件)上构造只读BSI，不拷贝任何容器。
+   * buf 须按32字节对齐，并且在返回的BSI销毁前保持有效、不被修改；不得对返回的BSI调用修改操作。
+   * 格式不合法时返回 nullptr。
+   */
+    static auto frozenView(const char* buf, size_t length) -> Roaring64BsiPtr {
+        FrozenHeader header {};
+        if (reinterpret_cast<uintptr_t>(buf) % frozenAlignment != 0 || length < sizeof(header)) {
+            return nullptr;
+        }
+        std::memcpy(&header, buf, sizeof(header));
+        const size_t baseSize = (header.flags & frameOfReferenceFlag) != 0 ? sizeof(uint64_t) : 0;
+        if (std::memcmp(header.magic, frozenMagic.data(), frozenMagic.size()) != 0 ||
+            header.bitDepth > maxBitDepth ||
+            length < sizeof(header) + baseSize + (header.bitDepth + 1) * sizeof(FrozenSection)) {
+            return nullptr;
+        }
+
+        std::vector<FrozenSection> sections(header.bitDepth + 1);
+        std::memcpy(sections.data(), buf + sizeof(header) + baseSize,
+                    sections.size() * sizeof(FrozenSection));
+        for (const auto& section : sections) {
+            if (section.offset % frozenAlignment != 0 || section.offset > length ||
+                section.length > length - section.offset) {
+                return nullptr;
+            }
+        }
+
+        auto bsi = std::make_unique<Roaring64Bsi>();
+        bsi->minValue_ = header.minValue;
+        bsi->maxValue_ = header.maxValue;
+        bsi->runOptimized_ = (header.flags & 1) != 0;
+        bsi->frameOfReference_ = baseSize != 0;
+        std::memcpy(&bsi->base_, buf + sizeof(header), baseSize);
+        bsi->frozen_ = true;
+        bsi->existenceBitMap_ = Roaring64Map::frozenView(buf + sections[0].offset);
+        bsi->indexBitMapVec_.resize(header.bitDepth);
+        for (size_t i = 0; i < header.bitDepth; i++) {
+            bsi->indexBitMapVec_[i] = Roaring64Map::frozenView(buf + sections[i + 1].offset);
+        }
+        return bsi;
+    }
+
+    /**
+   * bsi_indexed_size: serializeIndexed 需要的字节数。
+   */
+    [[nodiscard]] auto indexedSizeInBytes() const -> size_t {
+        auto sections = indexedSections();
+        return sections.back().offset + sections.back().length;
+    }
+
+    /**
+   * bsi_serialize_indexed: 按带版本号的索引格式序列化：头部(magic、版本、位深、min/max、标志)，
+   * 开启 frame-of-reference 时的 base(版本2)，段目录(ebm和每个切片的偏移、长度、基数)，以及各 bitmap 的可移植序列化结果。返回写入的字节数。
+   */
+    auto serializeIndexed(char* buf) const -> size_t {
+        auto sections = indexedSections();
+        refreshMinMax();
+
+        IndexedHeader header {};
+        std::memcpy(header.magic, indexedMagic.data(), indexedMagic.size());
+        header.version = frameOfReference_ ? indexedVersion : 1;
+        header.bitDepth = bitCount();
+        header.minValue = minValue_;
+        header.maxValue = maxValue_;
+        header.flags = (runOptimized_ ? 1 : 0) | (frameOfReference_ ? frameOfReferenceFlag : 0);
+        std::memcpy(buf, &header, sizeof(header));
+        std::memcpy(buf + sizeof(header), &base_, baseSize());
+        std::memcpy(buf + sizeof(header) + baseSize(), sections.data(),
+                    sections.size() * sizeof(IndexedSection));
+
+        existenceBitMap_.write(buf + sections[0].offset);
+        for (size_t i = 0; i < bitCount(); i++) {
+            slice(i).write(buf + sections[i + 1].offset);
+        }
+        return sections.back().offset + sections.back().length;
+    }
+
+    /**
+   * bsi_deserialize_lazy: 读取 serializeIndexed 的结果，只解析头部、段目录和ebm，切片在第一次被用到时
+   * 才解析，只用到高位切片的查询只读取一小部分数据。buf 须在返回的BSI(及其拷贝)销毁前保持有效，
+   * 例如 mmap 的文件；修改操作会先解析全部切片。格式或版本不合法时返回 nullptr。
+   */
+    static auto deserializeLazy(const char* buf, size_t length) -> Roaring64BsiPtr {
+        IndexedHeader header {};
+        if (length < sizeof(header)) {
+            return nullptr;
+        }
+        std::memcpy(&header, buf, sizeof(header));
+        const size_t baseSize = header.version >= 2 && (header.flags & frameOfReferenceFlag) != 0
+                                        ? sizeof(uint64_t)
+                                        : 0;
+        if (std::memcmp(header.magic, indexedMagic.data(), indexedMagic.size()) != 0 ||
+            header.version == 0 || header.version > indexedVersion ||
+            header.bitDepth > maxBitDepth ||
+            length < sizeof(header) + baseSize + (header.bitDepth + 1) * sizeof(IndexedSection)) {
+            return nullptr;
+        }
+
+        std::vector<IndexedSection> sections(header.bitDepth + 1);
+        std::memcpy(sections.data(), buf + sizeof(header) + baseSize,
+                    sections.size() * sizeof(IndexedSection));
+        for (const auto& section : sections) {
+            if (section.offset > length || section.length > length - section.offset) {
+                return nullptr;
+            }
+        }
+
+        auto bsi = std::make_unique<Roaring64Bsi>();
+        bsi->minValue_ = header.minValue;
+        bsi->maxValue_ = header.maxValue;
+        bsi->runOptimized_ = (header.flags & 1) != 0;
+        bsi->frameOfReference_ = baseSize != 0;
+        std::memcpy(&bsi->base_, buf + sizeof(header), baseSize);
+        bsi->existenceBitMap_ =
+                Roaring64Map::readSafe(buf + sections[0].offset, sections[0].length);
+        bsi->indexBitMapVec_.resize(header.bitDepth);
+        if (header.bitDepth > 0) {
+            auto lazy = std::make_shared<LazySlices>();
+            lazy->buf = buf;
+            lazy->sections.assign(sections.begin() + 1, sections.end());
+            lazy->slices.resize(header.bitDepth);
+            lazy->loaded = std::make_unique<std::once_flag[]>(header.bitDepth);
+            bsi->lazySlices_ = std::move(lazy);
+        }
+        return bsi;
+    }
+
+    /**
+   * bsi_copy_on_write: 开启后，拷贝与 clone() 同原BSI共享全部切片(ebm 照常复制)，任一方第一次写入时
+   * 才复制切片。共享的是整个切片，不是 CRoaring 的共享容器，因此与普通 bitmap 混合运算、writeFrozen
+   * 都不受影响。拷贝会把原BSI的切片移入共享存储，共享切片的BSI不能在多个线程里同时拷贝或修改。
+   */
+    void setCopyOnWrite(bool copyOnWrite) {
+        hydrate();
+        copyOnWrite_ = copyOnWrite;
+    }
+
+    void runOptimize() {
+        hydrate();
+        existenceBitMap_.runOptimize();
+
+        for (auto& bmPtr : indexBitMapVec_) {
+            bmPtr.runOptimize();
+        }
+        runOptimized_ = true;
     }
 
     auto hasRunCompression() const -> bool { return runOptimized_; }
@@ -573,23 +1475,59 @@ private:
 
         minValue_ = 0;
         maxValue_ = 0;
+        minMaxDirty_ = false;
+        zones_.reset();
+        zonelessQueries_ = 0;
+        frozen_ = false;
+        copyOnWrite_ = false;
+        sharedSlices_.reset();
+        frameOfReference_ = false;
+        base_ = 0;
         runOptimized_ = false;
+        lazySlices_.reset();
     }
 
     void ensureCapacityInternal(uint64_t minValue, uint64_t maxValue) {
+        hydrate();
         if (existenceBitMap_.isEmpty()) {
+            if (frameOfReference_) {
+                base_ = minValue;
+            }
             minValue_ = minValue;
             maxValue_ = maxValue;
-            grow(std::max(getBitDepth(maxValue), 1UL));
-        } else if (minValue_ > minValue) {
-            minValue_ = minValue;
-        } else if (maxValue_ < maxValue) {
-            maxValue_ = maxValue;
-            grow(std::max(getBitDepth(maxValue), 1UL));
+            minMaxDirty_ = false;
+            grow(std::max(getBitDepth(maxValue - base_), 1UL));
+            return;
+        }
+
+        if (minValue < base_) {
+            rebase(loweredBase(base_, minValue, bitCount()));
+        }
+        if (minMaxDirty_) {
+            // the next refreshMinMax rescans the slices anyway
+            grow(getBitDepth(maxValue - base_));
+        } else {
+            minValue_ = std::min(minValue_, minValue);
+            if (maxValue_ < maxValue) {
+                maxValue_ = maxValue;
+                grow(std::max(getBitDepth(maxValue - base_), 1UL));
+            }
         }
     }
 
+    /**
+     * The base a write of 'value' below 'base' lowers an index of 'bitDepth' slices to. It leaves
+     * headroom as large as the span the slices already cover, or the gap when that is larger, so
+     * that ever smaller writes re-encode the index O(log n) times in all, not once per write.
+     */
+    static auto loweredBase(uint64_t base, uint64_t value, size_t bitDepth) -> uint64_t {
+        const uint64_t span = bitDepth >= 64 ? UINT64_MAX : (uint64_t {1} << bitDepth) - 1;
+        const uint64_t headroom = std::max(base - value, span);
+        return value > headroom ? value - headroom : 0;
+    }
+
     void setValueInternal(uint64_t columnId, uint64_t value) {
+        value -= base_;
         for (size_t i = 0; i < bitCount(); i++) {
             if ((value & (1L << i)) > 0) {
                 indexBitMapVec_[i].add(columnId);
@@ -600,6 +1538,57 @@ private:
         existenceBitMap_.add(columnId);
     }
 
+    // Transposes the stored values (value - base_) 64 rows at a time, so that block[i] holds bit
+    // i of every row, and appends the ids of the set bits to per-slice buffers that are flushed
+    // with addMany.
+    void appendSlices(std::span<const uint64_t> columnIds, std::span<const uint64_t> values) {
+        const size_t depth = bitCount();
+        std::vector<std::vector<uint64_t>> pending(depth);
+        for (auto& ids : pending) {
+            ids.reserve(bulkFlushSize + std::tuple_size_v<BitBlock>);
+        }
+        auto flush = [this, &pending](size_t i) {
+            indexBitMapVec_[i].addMany(pending[i].size(), pending[i].data());
+            pending[i].clear();
+        };
+
+        BitBlock block {};
+        for (size_t begin = 0; begin < values.size(); begin += block.size()) {
+            size_t rows = std::min(block.size(), values.size() - begin);
+            std::transform(values.begin() + begin, values.begin() + begin + rows, block.begin(),
+                           [this](uint64_t value) { return value - base_; });
+            std::fill(block.begin() + rows, block.end(), 0);
+            transposeBlock(block);
+
+            for (size_t i = 0; i < depth; i++) {
+                for (uint64_t bits = block[i]; bits != 0; bits &= bits - 1) {
+                    pending[i].push_back(columnIds[begin + std::countr_zero(bits)]);
+                }
+                if (pending[i].size() >= bulkFlushSize) {
+                    flush(i);
+                }
+            }
+        }
+        for (size_t i = 0; i < depth; i++) {
+            if (!pending[i].empty()) {
+                flush(i);
+            }
+        }
+    }
+
+    // 64x64 bit-matrix transpose (Hacker's Delight 7-3): afterwards bit r of block[i] is bit i
+    // of the former block[r]. Swaps ever smaller off-diagonal sub-blocks, six rounds in all.
+    static void transposeBlock(std::span<uint64_t, std::tuple_size_v<BitBlock>> block) {
+        uint64_t mask = 0x00000000FFFFFFFFULL;
+        for (size_t width = 32; width != 0; width >>= 1, mask ^= (mask << width)) {
+            for (size_t k = 0; k < block.size(); k = ((k | width) + 1) & ~width) {
+                uint64_t swap = ((block[k] >> width) ^ block[k | width]) & mask;
+                block[k | width] ^= swap;
+                block[k] ^= swap << width;
+            }
+        }
+    }
+
     void grow(size_t newBitDepth) {
         size_t oldBitDepth = indexBitMapVec_.size();
 
@@ -614,194 +1603,1751 @@ private:
         }
     }
 
-    [[nodiscard]] auto minValue() const -> uint64_t {
+    [[nodiscard]] auto minMaxValue() const -> std::pair<uint64_t, uint64_t> {
         if (existenceBitMap_.isEmpty()) {
-            return 0;
+            return {0, 0};
         }
+        auto [minValue, maxValue] = storedBounds(existenceBitMap_, wholeSlices());
+        return {minValue + base_, maxValue + base_};
+    }
 
-        auto minValuesId = existenceBitMap_;
-        for (int i = indexBitMapVec_.size() - 1; i >= 0; i -= 1) {
-            auto tmp = minValuesId - indexBitMapVec_[i];
-            if (!tmp.isEmpty()) {
-                minValuesId = tmp;
+    /**
+     * Exact smallest and largest stored value of the non-empty 'rows', in one top-down pass over
+     * the slices. The max candidates keep the rows with the current bit when any has it, the min
+     * candidates drop them unless all have it; the checks don't materialize anything, and a
+     * candidate set is only copied once it narrows.
+     */
+    template <typename Bitmap, typename SliceAt>
+    [[nodiscard]] auto storedBounds(const Bitmap& rows, const SliceAt& sliceAt) const
+            -> std::pair<uint64_t, uint64_t> {
+        Bitmap minRows;
+        Bitmap maxRows;
+        const Bitmap* minIds = &rows;
+        const Bitmap* maxIds = &rows;
+        uint64_t minValue = 0;
+        uint64_t maxValue = 0;
+        for (size_t i = bitCount(); i-- > 0;) {
+            const auto& bits = sliceAt(i);
+            if (minIds->isSubset(bits)) {
+                minValue |= 1ULL << i;
+            } else if (minIds == &minRows) {
+                minRows -= bits;
+            } else {
+                minRows = *minIds - bits;
+                minIds = &minRows;
+            }
+            if (maxIds->intersect(bits)) {
+                maxValue |= 1ULL << i;
+                if (maxIds == &maxRows) {
+                    maxRows &= bits;
+                } else {
+                    maxRows = *maxIds & bits;
+                    maxIds = &maxRows;
+                }
             }
         }
-
-        return valueAt(minValuesId.minimum());
+        return {minValue, maxValue};
     }
 
-    [[nodiscard]] auto maxValue() const -> uint64_t {
-        if (existenceBitMap_.isEmpty()) {
-            return 0;
+    /**
+     * The zone of every non-empty high-key chunk of the ebm, in key order. Built by a bulk load
+     * into an empty index, or else by a query once usesZones() says so (chunk-parallel with a
+     * thread pool); kept up to date by setValue / setValues and rebase, dropped by add, addMany
+     * and merge.
+     */
+    [[nodiscard]] auto chunkZones() const -> std::shared_ptr<const std::vector<ChunkZone>> {
+        std::lock_guard<std::mutex> lock(zonesMutex_);
+        if (zones_ != nullptr) {
+            return zones_;
         }
 
-        auto maxValuesId = existenceBitMap_;
-        for (int i = indexBitMapVec_.size() - 1; i >= 0; i -= 1) {
-            auto tmp = maxValuesId & indexBitMapVec_[i];
-            if (!tmp.isEmpty()) {
-                maxValuesId = tmp;
+        std::vector<std::pair<uint32_t, const Roaring*>> chunks;
+        for (const auto& [key, chunk] : existenceBitMap_.getRoarings()) {
+            if (!chunk.isEmpty()) {
+                chunks.emplace_back(key, &chunk);
+            }
+        }
+        auto zones = std::make_shared<std::vector<ChunkZone>>(chunks.size());
+        auto build = [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                const auto [key, chunk] = chunks[c];
+                auto sliceAt = chunkSlices(key);
+                auto [minValue, maxValue] = storedBounds(*chunk, sliceAt);
+                auto& zone = (*zones)[c];
+                const uint64_t cardinality = chunk->cardinality();
+                zone = {key, minValue + base_, maxValue + base_, cardinality,
+                        weightedSum(bitCount(), cardinality,
+                                    [&](size_t i) { return sliceAt(i).cardinality(); })};
             }
+        };
+        if (runsParallel(chunks.size())) {
+            parallelRanges(chunks.size(), build);
+        } else {
+            build(0, chunks.size());
         }
+        zones_ = std::move(zones);
+        return zones_;
+    }
 
-        return valueAt(maxValuesId.minimum());
+    [[nodiscard]] auto zonesOf(std::span<const uint64_t> columnIds,
+                               std::span<const uint64_t> values) const
+            -> std::shared_ptr<std::vector<ChunkZone>> {
+        auto zones = std::make_shared<std::vector<ChunkZone>>();
+        for (size_t r = 0; r < columnIds.size(); r++) {
+            const auto key = static_cast<uint32_t>(columnIds[r] >> 32);
+            if (zones->empty() || zones->back().key != key) {
+                zones->push_back({key, values[r], values[r], 0, 0});
+            }
+            auto& zone = zones->back();
+            zone.minValue = std::min(zone.minValue, values[r]);
+            zone.maxValue = std::max(zone.maxValue, values[r]);
+            zone.cardinality++;
+            zone.storedSum += values[r] - base_;
+        }
+        return zones;
     }
 
-    [[nodiscard]] auto valueAt(uint64_t columnId) const -> uint64_t {
-        uint64_t value = 0;
-        for (size_t i = 0; i < bitCount(); i += 1) {
-            if (indexBitMapVec_[i].contains(columnId)) {
-                value |= (1L << i);
+    /**
+     * Whether a query prunes with the chunk zones. They only tell more than minValue_ /
+     * maxValue_ when the ebm spans several chunks, and are left out on deserializeLazy and
+     * frozen indexes, which are opened for a few queries and would have every slice read to
+     * build them. Zones that are missing are built by the zoneBuildQueries-th query without
+     * them, as the scan costs about as much as that many queries.
+     */
+    [[nodiscard]] auto usesZones() const -> bool {
+        if (existenceBitMap_.getRoarings().size() <= 1 || lazySlices_ != nullptr || frozen_) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(zonesMutex_);
+            if (zones_ != nullptr) {
+                return true;
             }
         }
+        return zonelessQueries_.fetch_add(1, std::memory_order_relaxed) + 1 >= zoneBuildQueries;
+    }
 
-        return value;
+    // the zone of chunk 'key' for a write of 'value', added in key order if the chunk is new
+    auto zoneToWiden(uint32_t key, uint64_t value) -> ChunkZone& {
+        auto it = std::lower_bound(zones_->begin(), zones_->end(), key,
+                                   [](const ChunkZone& zone, uint32_t k) { return zone.key < k; });
+        if (it == zones_->end() || it->key != key) {
+            it = zones_->insert(it, {key, value, value, 0, 0});
+        }
+        return *it;
     }
 
-    void addDigit(const Roaring64Map& foundSet, size_t i) {
-        Roaring64Map carry = indexBitMapVec_[i] & foundSet;
-        indexBitMapVec_[i] ^= foundSet;
-        if (!carry.isEmpty()) {
-            if (i + 1 >= bitCount()) {
-                grow(bitCount() + 1);
+    /**
+     * Accounts a write of 'value' to a row of 'zone' that held 'previous', if anything. The
+     * bounds are only widened, as narrowing them would need the other rows, so they stay bounds;
+     * the cardinality and the sum stay exact.
+     */
+    void widenZone(ChunkZone& zone, uint64_t value, std::optional<uint64_t> previous) const {
+        zone.minValue = std::min(zone.minValue, value);
+        zone.maxValue = std::max(zone.maxValue, value);
+        if (previous.has_value()) {
+            zone.storedSum -= *previous - base_;
+        } else {
+            zone.cardinality++;
+        }
+        zone.storedSum += value - base_;
+    }
+
+    // widenZone for every row of a sorted bulk write; 'overwritten' are its rows holding a value
+    void widenZones(std::span<const uint64_t> columnIds, std::span<const uint64_t> values,
+                    const Roaring64Map& overwritten) {
+        const auto previous = getValues(overwritten);
+        auto next = overwritten.begin();
+        size_t p = 0;
+        ChunkZone* zone = nullptr;
+        for (size_t r = 0; r < columnIds.size(); r++) {
+            const auto key = static_cast<uint32_t>(columnIds[r] >> 32);
+            if (zone == nullptr || zone->key != key) {
+                zone = &zoneToWiden(key, values[r]);
             }
-            addDigit(carry, i + 1);
+            std::optional<uint64_t> old;
+            if (p < previous.size() && *next == columnIds[r]) {
+                old = previous[p++];
+                ++next;
+            }
+            widenZone(*zone, values[r], old);
         }
     }
 
-    [[nodiscard]] auto sumInternal(const Roaring64Map& foundSet) const
-            -> std::tuple<uint64_t, uint64_t> {
-        if (foundSet.isEmpty()) {
-            return std::make_tuple(0, 0);
+    static auto zoneOf(const std::vector<ChunkZone>& zones, uint32_t key) -> const ChunkZone* {
+        auto it = std::lower_bound(zones.begin(), zones.end(), key,
+                                   [](const ChunkZone& zone, uint32_t k) { return zone.key < k; });
+        return it != zones.end() && it->key == key ? &*it : nullptr;
+    }
+
+    // min/max after the slices changed: rescanned now, or by the next reader when deferred
+    void updateMinMax() {
+        if (deferMinMax_) {
+            minMaxDirty_ = true;
+        } else {
+            std::tie(minValue_, maxValue_) = minMaxValue();
+            minMaxDirty_ = false;
         }
-        uint64_t count = foundSet.cardinality();
-        uint64_t sum = 0;
-        for (size_t i = 0; i < bitCount(); i++) {
-            sum += (1L << i) * (indexBitMapVec_[i] & foundSet).cardinality();
+    }
+
+    // called by every reader of minValue_ / maxValue_; const queries may race to get here
+    void refreshMinMax() const {
+        if (!minMaxDirty_.load(std::memory_order_acquire)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(minMaxMutex_);
+        if (minMaxDirty_.load(std::memory_order_relaxed)) {
+            std::tie(minValue_, maxValue_) = minMaxValue();
+            minMaxDirty_.store(false, std::memory_order_release);
         }
-        return std::make_tuple(sum, count);
     }
 
-    [[nodiscard]] auto compareUsingMinMax(BsiOperation operation, uint64_t startOrValue,
-                                          uint64_t end,
-                                          const Roaring64Map* foundSet = nullptr) const
-            -> Roaring64MapPtr {
-        Roaring64MapPtr allBitmap = std::make_unique<Roaring64Map>(
-                foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_);
+    /**
+     * Decodes the values of 'ids' into 'out' (one per id, ascending), one high-key chunk at a
+     * time; chunks run in parallel when a thread pool is set.
+     */
+    void decodeInto(const Roaring64Map& ids, std::span<uint64_t> out) const {
+        std::vector<std::tuple<uint32_t, const Roaring*, size_t>> chunks;
+        size_t offset = 0;
+        for (const auto& [key, chunk] : ids.getRoarings()) {
+            chunks.emplace_back(key, &chunk, offset);
+            offset += chunk.cardinality();
+        }
 
-        Roaring64MapPtr emptyBitmap = std::make_unique<Roaring64Map>();
+        auto decodeRange = [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                const auto& [key, chunk, chunkOffset] = chunks[c];
+                decodeChunk(key, *chunk, out.subspan(chunkOffset, chunk->cardinality()));
+            }
+        };
+        if (runsParallel(chunks.size())) {
+            parallelRanges(chunks.size(), decodeRange);
+        } else {
+            decodeRange(0, chunks.size());
+        }
+    }
 
-        switch (operation) {
-        case LT:
-            if (startOrValue > maxValue_) {
-                return allBitmap;
-            } else if (startOrValue <= minValue_) {
-                return emptyBitmap;
+    /**
+     * Decodes one 32-bit chunk of ids. Every slice is merge-walked once against the ids; the bit
+     * of the id at position p goes to word i of the 64-id block holding p, which is laid out in
+     * 'out' itself, so transposing each block in place leaves the values behind.
+     */
+    void decodeChunk(uint32_t key, const Roaring& ids, std::span<uint64_t> out) const {
+        std::vector<uint32_t> lowIds(out.size());
+        ids.toUint32Array(lowIds.data());
+
+        BitBlock tail {};
+        const size_t fullBlocks = out.size() - out.size() % tail.size();
+        std::fill(out.begin(), out.end(), 0);
+        for (size_t i = 0; i < bitCount(); i++) {
+            size_t pos = 0;
+            for (uint32_t low : chunkOf(slice(i), key) & ids) {
+                while (lowIds[pos] != low) {
+                    pos++;
+                }
+                uint64_t& word = pos < fullBlocks ? out[pos - pos % tail.size() + i]
+                                                  : tail[i];
+                word |= 1ULL << (pos % tail.size());
             }
-            break;
-        case LE:
-            if (startOrValue >= maxValue_) {
-                return allBitmap;
-            } else if (startOrValue < minValue_) {
-                return emptyBitmap;
+        }
+
+        for (size_t begin = 0; begin < fullBlocks; begin += tail.size()) {
+            transposeBlock(out.subspan(begin).first<std::tuple_size_v<BitBlock>>());
+        }
+        if (fullBlocks < out.size()) {
+            transposeBlock(tail);
+            std::copy_n(tail.begin(), out.size() - fullBlocks, out.begin() + fullBlocks);
+        }
+    }
+
+    /**
+     * Value histogram for shallow indexes: the rows are split top-down on each slice, and every
+     * non-empty partition left below the lowest slice is one distinct value. Only cardinalities
+     * are taken on the last slice. Values come out in ascending order.
+     */
+    void partitionHistogram(const Roaring64Map& rows, size_t depth, uint64_t prefix,
+                            std::vector<uint64_t>& values, std::vector<uint64_t>& counts) const {
+        if (depth == 0) {
+            values.push_back(prefix);
+            counts.push_back(rows.cardinality());
+            return;
+        }
+
+        const auto& slice = this->slice(depth - 1);
+        const uint64_t bit = 1ULL << (depth - 1);
+        if (depth == 1) {
+            const uint64_t ones = rows.and_cardinality(slice);
+            const uint64_t zeros = rows.cardinality() - ones;
+            if (zeros > 0) {
+                values.push_back(prefix);
+                counts.push_back(zeros);
             }
-            break;
-        case GT:
-            if (startOrValue < minValue_) {
-                return allBitmap;
-            } else if (startOrValue >= maxValue_) {
-                return emptyBitmap;
+            if (ones > 0) {
+                values.push_back(prefix | bit);
+                counts.push_back(ones);
             }
-            break;
-        case GE:
-            if (startOrValue <= minValue_) {
-                return allBitmap;
-            } else if (startOrValue > maxValue_) {
-                return emptyBitmap;
+            return;
+        }
+
+        auto zeros = rows - slice;
+        if (!zeros.isEmpty()) {
+            partitionHistogram(zeros, depth - 1, prefix, values, counts);
+        }
+        auto ones = rows & slice;
+        if (!ones.isEmpty()) {
+            partitionHistogram(ones, depth - 1, prefix | bit, values, counts);
+        }
+    }
+
+    /**
+     * Value histogram for deep indexes: decodes the rows in bulk, radix sorts the values and
+     * counts the runs. Like partitionHistogram, it yields stored values (without base_).
+     */
+    void sortedHistogram(const Roaring64Map& rows, std::vector<uint64_t>& values,
+                         std::vector<uint64_t>& counts) const {
+        std::vector<uint64_t> decoded(rows.cardinality());
+        decodeInto(rows, decoded);
+        radixSort(decoded, bitCount());
+        for (size_t begin = 0; begin < decoded.size();) {
+            size_t end = begin + 1;
+            while (end < decoded.size() && decoded[end] == decoded[begin]) {
+                end++;
             }
-            break;
-        case EQ:
-            if (minValue_ == maxValue_ && minValue_ == startOrValue) {
-                return allBitmap;
-            } else if (startOrValue < minValue_ || startOrValue > maxValue_) {
-                return emptyBitmap;
+            values.push_back(decoded[begin]);
+            counts.push_back(end - begin);
+            begin = end;
+        }
+    }
+
+    // LSD radix sort on radixSortBits-bit digits, skipping the digits above bitDepth.
+    static void radixSort(std::vector<uint64_t>& data, size_t bitDepth) {
+        constexpr uint64_t mask = (1ULL << radixSortBits) - 1;
+        std::vector<uint64_t> buffer(data.size());
+        std::vector<size_t> offsets(mask + 2);
+        for (size_t shift = 0; shift < bitDepth; shift += radixSortBits) {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            for (uint64_t value : data) {
+                offsets[((value >> shift) & mask) + 1]++;
             }
-            break;
-        case NEQ:
-            if (minValue_ == maxValue_) {
-                if (minValue_ == startOrValue) {
-                    return emptyBitmap;
-                }
-                return allBitmap;
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            for (uint64_t value : data) {
+                buffer[offsets[(value >> shift) & mask]++] = value;
             }
-            break;
-        case RANGE:
-            if (startOrValue <= minValue_ && end >= maxValue_) {
-                return allBitmap;
-            } else if (startOrValue > maxValue_ || end < minValue_) {
-                return emptyBitmap;
+            data.swap(buffer);
+        }
+    }
+
+    /**
+     * Slice i, parsed from the deserializeLazy buffer on first use, or shared with copies under
+     * copy-on-write. Safe to call concurrently.
+     */
+    [[nodiscard]] auto slice(size_t i) const -> const Roaring64Map& {
+        if (sharedSlices_ != nullptr) {
+            return (*sharedSlices_)[i];
+        }
+        if (lazySlices_ == nullptr) {
+            return indexBitMapVec_[i];
+        }
+        auto& lazy = *lazySlices_;
+        std::call_once(lazy.loaded[i], [&lazy, i] {
+            const auto& section = lazy.sections[i];
+            lazy.slices[i] = Roaring64Map::readSafe(lazy.buf + section.offset, section.length);
+        });
+        return lazy.slices[i];
+    }
+
+    /**
+     * Moves the slices into sharedSlices_ for a copy to share, leaving empty placeholders in
+     * indexBitMapVec_ so that bitCount() holds. Lazy slices are already shared by copies.
+     */
+    void shareSlices() const {
+        if (sharedSlices_ != nullptr || lazySlices_ != nullptr) {
+            return;
+        }
+        sharedSlices_ = std::make_shared<std::vector<Roaring64Map>>(std::move(indexBitMapVec_));
+        indexBitMapVec_ = std::vector<Roaring64Map>(sharedSlices_->size());
+    }
+
+    /**
+     * Takes back the slices shared with copies (copying them unless no copy is left) and parses
+     * every slice still left in the deserializeLazy buffer into indexBitMapVec_; called before
+     * the slices are modified.
+     */
+    void hydrate() {
+        if (sharedSlices_ != nullptr) {
+            if (sharedSlices_.use_count() == 1) {
+                indexBitMapVec_ = std::move(*sharedSlices_);
+            } else {
+                indexBitMapVec_ = *sharedSlices_;
             }
-            break;
-        default:
-            return nullptr;
+            sharedSlices_.reset();
+        }
+        if (lazySlices_ == nullptr) {
+            return;
+        }
+        const bool shared = lazySlices_.use_count() > 1;
+        for (size_t i = 0; i < bitCount(); i++) {
+            const auto& loaded = slice(i);
+            indexBitMapVec_[i] = shared ? loaded : std::move(lazySlices_->slices[i]);
         }
+        lazySlices_.reset();
+    }
 
-        return nullptr;
+    // bytes of the base stored after the header of each serialized format
+    [[nodiscard]] auto baseSize() const -> size_t {
+        return frameOfReference_ ? sizeof(base_) : 0;
     }
 
-    [[nodiscard]] auto oNeilCompare(BsiOperation operation, uint64_t predicate,
-                                    const Roaring64Map* foundSet = nullptr) const
-            -> Roaring64MapPtr {
-        const auto& fixedFoundSet = foundSet != nullptr ? *foundSet : existenceBitMap_;
+    /**
+     * Directory of the indexed layout: offsets (from the start of the buffer), lengths and
+     * cardinalities of the ebm and slice sections.
+     */
+    [[nodiscard]] auto indexedSections() const -> std::vector<IndexedSection> {
+        std::vector<IndexedSection> sections;
+        sections.reserve(bitCount() + 1);
+        uint64_t offset =
+                sizeof(IndexedHeader) + baseSize() + (bitCount() + 1) * sizeof(IndexedSection);
+        auto append = [&](const Roaring64Map& bitmap, uint64_t cardinality) {
+            sections.push_back({offset, bitmap.getSizeInBytes(), cardinality});
+            offset += sections.back().length;
+        };
+        append(existenceBitMap_, existenceBitMap_.cardinality());
+        for (size_t i = 0; i < bitCount(); i++) {
+            append(slice(i), getSliceCardinality(i));
+        }
+        return sections;
+    }
+
+    /**
+     * Offsets (from the start of the frozen buffer) and lengths of the ebm and slice sections.
+     */
+    [[nodiscard]] auto frozenSections() const -> std::vector<FrozenSection> {
+        auto align = [](uint64_t offset) {
+            return (offset + frozenAlignment - 1) / frozenAlignment * frozenAlignment;
+        };
+
+        std::vector<FrozenSection> sections;
+        sections.reserve(indexBitMapVec_.size() + 1);
+        uint64_t offset = align(sizeof(FrozenHeader) + baseSize() +
+                                (indexBitMapVec_.size() + 1) * sizeof(FrozenSection));
+        auto append = [&](const Roaring64Map& bitmap) {
+            sections.push_back({offset, bitmap.getFrozenSizeInBytes()});
+            offset = align(offset + sections.back().length);
+        };
+        append(existenceBitMap_);
+        for (size_t i = 0; i < bitCount(); i++) {
+            append(slice(i));
+        }
+        return sections;
+    }
 
-        Roaring64Map gtBitMap;
-        Roaring64Map ltBitMap;
-        Roaring64MapPtr eqBitMap = std::make_unique<Roaring64Map>(existenceBitMap_);
+    [[nodiscard]] auto extremeOf(const Roaring64Map* foundSet, bool largest) const
+            -> std::tuple<uint64_t, Roaring64MapPtr> {
+        auto rows = std::make_unique<Roaring64Map>(
+                foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_);
+        if (rows->isEmpty()) {
+            return std::make_tuple(0, std::move(rows));
+        }
+        if (usesZones()) {
+            pruneExtremeChunks(*rows, largest);
+        }
+        const uint64_t value = narrowToExtreme(*rows, largest);
+        return std::make_tuple(value + base_, std::move(rows));
+    }
 
-        for (int32_t i = bitCount() - 1; i >= 0; i--) {
-            auto bit = (int32_t)((predicate >> i) & 1);
-            if (bit == 1) {
-                ltBitMap |= (*eqBitMap - indexBitMapVec_[i]);
-                *eqBitMap &= indexBitMapVec_[i];
-            } else {
-                gtBitMap |= (*eqBitMap & indexBitMapVec_[i]);
-                *eqBitMap -= indexBitMapVec_[i];
+    /**
+     * Drops the chunks of the non-empty 'rows' that cannot hold their extreme: every chunk left
+     * holds a value at least (at most) its zone minimum (maximum), so for the largest value a
+     * chunk whose zone maximum is below the highest zone minimum is out, and vice versa.
+     */
+    void pruneExtremeChunks(Roaring64Map& rows, bool largest) const {
+        auto zones = chunkZones();
+        std::vector<const ChunkZone*> chunks;
+        for (const auto& [key, chunk] : rows.getRoarings()) {
+            chunks.push_back(zoneOf(*zones, key));
+        }
+        uint64_t bound = largest ? 0 : UINT64_MAX;
+        for (const auto* zone : chunks) {
+            bound = largest ? std::max(bound, zone->minValue) : std::min(bound, zone->maxValue);
+        }
+        for (const auto* zone : chunks) {
+            if (largest ? zone->maxValue < bound : zone->minValue > bound) {
+                rows.setRoaring(zone->key, Roaring {});
             }
         }
+    }
 
-        *eqBitMap &= fixedFoundSet;
-        switch (operation) {
-        case EQ:
-            return eqBitMap;
-        case NEQ:
-            return std::make_unique<Roaring64Map>(fixedFoundSet - *eqBitMap);
-        case GT:
-            return std::make_unique<Roaring64Map>(gtBitMap & fixedFoundSet);
-        case LT:
-            return std::make_unique<Roaring64Map>(ltBitMap & fixedFoundSet);
-        case LE:
-            return std::make_unique<Roaring64Map>((ltBitMap | *eqBitMap) & fixedFoundSet);
-        case GE:
-            return std::make_unique<Roaring64Map>((gtBitMap | *eqBitMap) & fixedFoundSet);
-        default:
-            return nullptr;
+    /**
+     * Smallest or largest stored value of the non-empty 'rows', narrowing 'rows' in place to the
+     * rows holding it. Once the rows fit one high-key chunk the walk goes on over that chunk
+     * alone, and a single row left is decoded directly.
+     */
+    [[nodiscard]] auto narrowToExtreme(Roaring64Map& rows, bool largest) const -> uint64_t {
+        uint64_t value = 0;
+        size_t i = bitCount();
+        for (; i > 0 && rows.getRoarings().size() > 1; i--) {
+            value |= narrowStep(rows, slice(i - 1), largest) << (i - 1);
+        }
+        if (i == 0) {
+            return value;
         }
-        return nullptr;
+
+        const uint32_t key = rows.getRoarings().begin()->first;
+        Roaring chunk = rows.getRoarings().begin()->second;
+        auto sliceAt = chunkSlices(key);
+        for (; i > 0; i--) {
+            if (chunk.cardinality() == 1) {
+                value = valueAt((static_cast<uint64_t>(key) << 32) | chunk.minimum());
+                break;
+            }
+            value |= narrowStep(chunk, sliceAt(i - 1), largest) << (i - 1);
+        }
+        rows.setRoaring(key, std::move(chunk));
+        return value;
     }
 
-    static auto leadingZeroes(uint64_t value) -> size_t {
-        return (value < 1) ? maxBitDepth : __builtin_clzll(value);
+    // one step of narrowToExtreme: whether the extreme has the bit of 'bits', keeping in 'rows'
+    // only the rows that agree with it
+    template <typename Bitmap>
+    static auto narrowStep(Bitmap& rows, const Bitmap& bits, bool largest) -> uint64_t {
+        if (largest) {
+            if (!rows.intersect(bits)) {
+                return 0;
+            }
+            rows &= bits;
+            return 1;
+        }
+        if (rows.isSubset(bits)) {
+            return 1;
+        }
+        rows -= bits;
+        return 0;
     }
 
-    static auto getBitDepth(uint64_t value) -> size_t { return maxBitDepth - leadingZeroes(value); }
+    /**
+     * Stored value of rank 'rank' among 'candidates' ('count' rows), top-down: with n1 of the
+     * candidates having the current bit set, the answer has the bit clear iff rank < count - n1,
+     * and the candidates narrow to the rows agreeing with it. Chunks are counted and narrowed in
+     * parallel when a pool is set; a single remaining row is decoded directly.
+     */
+    [[nodiscard]] auto kthStoredValue(const Roaring64Map& candidates, uint64_t count,
+                                      uint64_t rank) const -> uint64_t {
+        std::vector<std::pair<uint32_t, Roaring>> chunks(candidates.getRoarings().begin(),
+                                                         candidates.getRoarings().end());
+        std::vector<uint64_t> ones(chunks.size());
+        uint64_t value = 0;
+        for (int32_t bit = static_cast<int32_t>(bitCount()) - 1; bit >= 0; bit--) {
+            if (count == 1) {
+                for (const auto& [key, chunk] : chunks) {
+                    if (!chunk.isEmpty()) {
+                        return valueAt((static_cast<uint64_t>(key) << 32) | chunk.minimum());
+                    }
+                }
+            }
 
-    uint64_t maxValue_ {0};
-    uint64_t minValue_ {0};
-    bool runOptimized_ {false};
+            const Roaring64Map& bitSlice = slice(bit);
+            forEachChunk(chunks.size(), [&](size_t c) {
+                ones[c] = chunks[c].second.and_cardinality(chunkOf(bitSlice, chunks[c].first));
+            });
+            const uint64_t setCount = std::accumulate(ones.begin(), ones.end(), uint64_t {0});
+            const uint64_t clearCount = count - setCount;
+            const bool bitSet = rank >= clearCount;
+            // nothing to narrow when every candidate agrees on the bit already
+            const bool narrow = setCount != 0 && clearCount != 0;
+            if (bitSet) {
+                value |= 1UL << bit;
+                rank -= clearCount;
+                count = setCount;
+            } else {
+                count = clearCount;
+            }
+            if (narrow) {
+                forEachChunk(chunks.size(), [&](size_t c) {
+                    const Roaring& sliceChunk = chunkOf(bitSlice, chunks[c].first);
+                    if (bitSet) {
+                        chunks[c].second &= sliceChunk;
+                    } else {
+                        chunks[c].second -= sliceChunk;
+                    }
+                });
+            }
+        }
+        return value;
+    }
 
-    std::vector<Roaring64Map> indexBitMapVec_;
+    [[nodiscard]] auto valueAt(uint64_t columnId) const -> uint64_t {
+        uint64_t value = 0;
+        for (size_t i = 0; i < bitCount(); i += 1) {
+            if (slice(i).contains(columnId)) {
+                value |= (1L << i);
+            }
+        }
+
+        return value;
+    }
+
+    // Adds 'depth' addend slices (addend(i) of weight 2^i) to the stored values, rippling the
+    // carries from the lowest slice up. The sum needs at most one more slice than the deeper
+    // operand, so the index grows once, here.
+    template <typename Slices>
+    void rippleAdd(size_t depth, const Slices& addend) {
+        grow(std::max(bitCount(), depth) + 1);
+        std::vector<Roaring64Map> carries;
+        std::vector<Roaring64Map> nextCarries;
+        for (size_t i = 0; i < bitCount(); i++) {
+            if (i < depth) {
+                halfAdd(indexBitMapVec_[i], addend(i), nextCarries);
+            } else if (carries.empty()) {
+                break;
+            }
+            for (const auto& carry : carries) {
+                halfAdd(indexBitMapVec_[i], carry, nextCarries);
+            }
+            carries.swap(nextCarries);
+            nextCarries.clear();
+        }
+        if (indexBitMapVec_.back().isEmpty()) {
+            indexBitMapVec_.pop_back();
+        }
+    }
+
+    /**
+     * Picks the base of this + other before the ebms are merged, and returns per bit the rows
+     * whose stored value is still short by that bit once the stored values have been added:
+     * rows only here by base_ - newBase, rows only in other by other.base_ - newBase, and rows
+     * on both sides by base_ + other.base_ - newBase.
+     */
+    auto rebaseForAdd(const Roaring64Bsi& other, bool disjoint) -> std::vector<Roaring64Map> {
+        const auto& mine = existenceBitMap_;
+        const auto& theirs = other.existenceBitMap_;
+        std::array<std::pair<Roaring64Map, uint64_t>, 3> groups {{
+                {mine - theirs, base_},
+                {theirs - mine, other.base_},
+                {disjoint ? Roaring64Map {} : mine & theirs, base_ + other.base_},
+        }};
+        uint64_t newBase = 0;
+        if (frameOfReference_) {
+            newBase = UINT64_MAX;
+            for (const auto& [rows, base] : groups) {
+                if (!rows.isEmpty()) {
+                    newBase = std::min(newBase, base);
+                }
+            }
+        }
+
+        std::vector<Roaring64Map> offsets;
+        for (const auto& [rows, base] : groups) {
+            const uint64_t offset = base - newBase;
+            if (rows.isEmpty() || offset == 0) {
+                continue;
+            }
+            offsets.resize(std::max(offsets.size(), getBitDepth(offset)));
+            for (uint64_t bits = offset; bits != 0; bits &= bits - 1) {
+                offsets[std::countr_zero(bits)] |= rows;
+            }
+        }
+        base_ = newBase;
+        return offsets;
+    }
+
+    void addBase(std::span<uint64_t> values) const {
+        if (base_ != 0) {
+            for (auto& value : values) {
+                value += base_;
+            }
+        }
+    }
+
+    /**
+     * Adds the bits of addend into a slice in place (sum ^= addend) and appends the carry
+     * (sum & addend) for the next slice. The carries of a slice are kept apart rather than
+     * merged into one majority bitmap: they are small and shrink as they ripple up, and adding
+     * them one by one costs less than materializing their union.
+     */
+    static void halfAdd(Roaring64Map& sum, const Roaring64Map& addend,
+                        std::vector<Roaring64Map>& carries) {
+        Roaring64Map carry = sum & addend;
+        sum ^= addend;
+        if (!carry.isEmpty()) {
+            carries.emplace_back(std::move(carry));
+        }
+    }
+
+    /**
+     * Stored sum and count of every group within one high-key chunk of the ebm. Groups without
+     * rows in the chunk, and groups holding all of its rows when the zone has their sum, are left
+     * out. A few groups are intersected with each slice chunk in turn while it is hot in cache;
+     * past groupSumDecodeThreshold the chunk is decoded window by window instead.
+     */
+    [[nodiscard]] auto groupSumOfChunk(uint32_t key, const Roaring& rows,
+                                       std::span<const Roaring64Map* const> groups,
+                                       const ChunkZone* zone) const
+            -> std::vector<std::tuple<unsigned __int128, uint64_t>> {
+        std::vector<std::tuple<unsigned __int128, uint64_t>> sums(groups.size());
+        std::vector<std::pair<size_t, const Roaring*>> scanned;
+        for (size_t g = 0; g < groups.size(); g++) {
+            const Roaring& group = groups[g] != nullptr ? chunkOf(*groups[g], key) : rows;
+            const uint64_t count =
+                    groups[g] != nullptr ? group.and_cardinality(rows) : rows.cardinality();
+            std::get<1>(sums[g]) = count;
+            if (zone != nullptr && count == zone->cardinality) {
+                std::get<0>(sums[g]) = zone->storedSum;
+            } else if (count > 0) {
+                scanned.emplace_back(g, &group);
+            }
+        }
+        if (scanned.empty()) {
+            return sums;
+        }
+        if (scanned.size() >= groupSumDecodeThreshold) {
+            groupSumByWindows(key, rows, scanned, sums);
+            return sums;
+        }
+
+        for (size_t i = 0; i < bitCount(); i++) {
+            const Roaring& bits = chunkOf(slice(i), key);
+            if (bits.isEmpty()) {
+                continue;
+            }
+            for (const auto& [g, group] : scanned) {
+                std::get<0>(sums[g]) += static_cast<unsigned __int128>(bits.and_cardinality(*group))
+                                        << i;
+            }
+        }
+        return sums;
+    }
+
+    /**
+     * groupSumOfChunk for many groups, whose cost then goes to the per-container intersections.
+     * Each 2^16-id window of the chunk is decoded once into a dense array and each group adds up
+     * the values at its ids; ids without a value decode to 0 and add nothing. A window with as
+     * many rows as a bitset container decodes word-wise: word i of each 64-id block is the bits
+     * of slice i, and transposing the block leaves the values behind, as in decodeChunk. Sparser
+     * windows scatter the ids of each slice bit by bit.
+     */
+    void groupSumByWindows(uint32_t key, const Roaring& rows,
+                           std::span<const std::pair<size_t, const Roaring*>> groups,
+                           std::vector<std::tuple<unsigned __int128, uint64_t>>& sums) const {
+        constexpr uint64_t window = uint64_t {1} << 16;
+        constexpr size_t blockSize = std::tuple_size_v<BitBlock>;
+        // rows past which a container is a bitset
+        constexpr uint64_t bitsetRows {4096};
+        std::vector<const Roaring*> bits(bitCount());
+        for (size_t i = 0; i < bitCount(); i++) {
+            bits[i] = &chunkOf(slice(i), key);
+        }
+        std::vector<uint64_t> values(window);
+        std::vector<uint64_t> words(window / blockSize);
+        std::vector<uint32_t> ids(window);
+
+        for (auto it = rows.begin(); it != rows.end();) {
+            const uint64_t begin = *it & ~(window - 1);
+            std::fill(values.begin(), values.end(), 0);
+            if (api::roaring_bitmap_range_cardinality(&rows.roaring, begin, begin + window) >
+                bitsetRows) {
+                for (size_t i = 0; i < bitCount(); i++) {
+                    if (windowWords(*bits[i], begin, words)) {
+                        for (size_t b = 0; b < words.size(); b++) {
+                            values[b * blockSize + i] = words[b];
+                        }
+                    }
+                }
+                for (size_t b = 0; b < words.size(); b++) {
+                    transposeBlock(std::span(values).subspan(b * blockSize).first<blockSize>());
+                }
+            } else {
+                for (size_t i = 0; i < bitCount(); i++) {
+                    for (uint32_t id : idsInWindow(*bits[i], begin, ids)) {
+                        values[id - begin] |= uint64_t {1} << i;
+                    }
+                }
+            }
+            for (const auto& [g, group] : groups) {
+                for (uint32_t id : idsInWindow(*group, begin, ids)) {
+                    std::get<0>(sums[g]) += values[id - begin];
+                }
+            }
+
+            if (begin + window > UINT32_MAX) {
+                break;
+            }
+            it.equalorlarger(static_cast<uint32_t>(begin + window));
+        }
+    }
+
+    // the bits of 'bitmap' over [begin, begin + 64 * words.size()) as words; false if none is set
+    static auto windowWords(const Roaring& bitmap, uint64_t begin, std::span<uint64_t> words)
+            -> bool {
+        Roaring range;
+        range.addRange(begin, begin + 64 * words.size());
+        Roaring part = bitmap & range;
+        if (part.isEmpty()) {
+            return false;
+        }
+        // shifted to 0, so that the bitset covers the window alone
+        api::roaring_bitmap_t* shifted =
+                api::roaring_bitmap_add_offset(&part.roaring, -static_cast<int64_t>(begin));
+        api::bitset_t* bitset = api::bitset_create();
+        api::roaring_bitmap_to_bitset(shifted, bitset);
+        std::fill(words.begin(), words.end(), 0);
+        std::copy_n(bitset->array, std::min(bitset->arraysize, words.size()), words.begin());
+        api::bitset_free(bitset);
+        api::roaring_bitmap_free(shifted);
+        return true;
+    }
+
+    // the ids of 'bitmap' in [begin, begin + ids.size()), read in bulk into 'ids'
+    static auto idsInWindow(const Roaring& bitmap, uint64_t begin, std::span<uint32_t> ids)
+            -> std::span<const uint32_t> {
+        const uint64_t count =
+                api::roaring_bitmap_range_cardinality(&bitmap.roaring, begin, begin + ids.size());
+        if (count == 0) {
+            return {};
+        }
+        auto it = bitmap.begin();
+        it.equalorlarger(static_cast<uint32_t>(begin));
+        return ids.first(api::roaring_read_uint32_iterator(&it.i, ids.data(), count));
+    }
+
+    /**
+     * Sum of squares, sum and count of the stored values of the rows with a value (within
+     * 'foundSet' when given). The square of a value is the sum of 2^(i+j) over every pair of its
+     * set bits i, j, so the squares come from |S_i & S_j & foundSet| for every i <= j: the slices
+     * are cut to the foundSet once, then all pairs are counted, in parallel with a pool.
+     */
+    [[nodiscard]] auto storedMoments(const Roaring64Map* foundSet) const
+            -> std::tuple<unsigned __int128, unsigned __int128, uint64_t> {
+        const uint64_t count = foundSet != nullptr ? existenceBitMap_.and_cardinality(*foundSet)
+                                                   : existenceBitMap_.cardinality();
+        if (count == 0) {
+            return std::make_tuple(0, 0, 0);
+        }
+
+        // the slices are subsets of the ebm, so without a foundSet they are used as they are
+        std::vector<Roaring64Map> cutSlices(foundSet != nullptr ? bitCount() : 0);
+        forEachChunk(cutSlices.size(), [&](size_t i) { cutSlices[i] = slice(i) & *foundSet; });
+        auto rowsOf = [&](size_t i) -> const Roaring64Map& {
+            return foundSet != nullptr ? cutSlices[i] : slice(i);
+        };
+
+        std::vector<std::pair<size_t, size_t>> pairs;
+        for (size_t i = 0; i < bitCount(); i++) {
+            for (size_t j = i; j < bitCount(); j++) {
+                pairs.emplace_back(i, j);
+            }
+        }
+        std::vector<uint64_t> counts(pairs.size());
+        forEachChunk(pairs.size(), [&](size_t p) {
+            const auto [i, j] = pairs[p];
+            counts[p] = i == j ? rowsOf(i).cardinality() : rowsOf(i).and_cardinality(slice(j));
+        });
+
+        unsigned __int128 squares = 0;
+        unsigned __int128 sum = 0;
+        for (size_t p = 0; p < pairs.size(); p++) {
+            const auto [i, j] = pairs[p];
+            const auto pairCount = static_cast<unsigned __int128>(counts[p]);
+            if (i == j) {
+                squares += pairCount << (2 * i);
+                sum += pairCount << i;
+            } else {
+                // the pair (j, i) adds the same again
+                squares += pairCount << (i + j + 1);
+            }
+        }
+        return std::make_tuple(squares, sum, count);
+    }
+
+    // sum of the stored values of the rows of 'foundSet' in the ebm, and their count
+    [[nodiscard]] auto sumInternal(const Roaring64Map& foundSet) const
+            -> std::tuple<unsigned __int128, uint64_t> {
+        if (foundSet.isEmpty()) {
+            return std::make_tuple(0, 0);
+        }
+        if (usesZones()) {
+            return chunkedSum(foundSet);
+        }
+
+        const uint64_t count = existenceBitMap_.and_cardinality(foundSet);
+        if (count == 0) {
+            return std::make_tuple(0, 0);
+        }
+        const unsigned __int128 sum = weightedSum(
+                bitCount(), count, [&](size_t i) { return slice(i).and_cardinality(foundSet); });
+        return std::make_tuple(sum, count);
+    }
+
+    /**
+     * Σ countAt(i)·2^i over 'bitDepth' slices, 'count' being the rows the counts are taken
+     * from. Their values are below 2^bitDepth, so the sum stays in 64 bits unless
+     * bitDepth + bit_width(count) exceeds 64; only then is it accumulated in 128 bits.
+     */
+    template <typename CountAt>
+    [[nodiscard]] static auto weightedSum(size_t bitDepth, uint64_t count, const CountAt& countAt)
+            -> unsigned __int128 {
+        if (bitDepth + std::bit_width(count) <= 64) [[likely]] {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < bitDepth; i++) {
+                sum += static_cast<uint64_t>(countAt(i)) << i;
+            }
+            return sum;
+        }
+        unsigned __int128 sum = 0;
+        for (size_t i = 0; i < bitDepth; i++) {
+            sum += static_cast<unsigned __int128>(countAt(i)) << i;
+        }
+        return sum;
+    }
+
+    /**
+     * Decides a compare from minValue_ / maxValue_ alone: true if every row matches, false if
+     * none does, std::nullopt if the slices have to be scanned.
+     */
+    [[nodiscard]] auto compareUsingMinMax(BsiOperation operation, uint64_t startOrValue,
+                                          uint64_t end) const -> std::optional<bool> {
+        refreshMinMax();
+        return decideByBounds(operation, startOrValue, end, minValue_, maxValue_);
+    }
+
+    /**
+     * Decides a compare for rows whose values lie in [minValue, maxValue]: true if every row
+     * matches, false if none does, std::nullopt if the slices have to be scanned.
+     */
+    [[nodiscard]] static auto decideByBounds(BsiOperation operation, uint64_t startOrValue,
+                                             uint64_t end, uint64_t minValue,
+                                             uint64_t maxValue) -> std::optional<bool> {
+        switch (operation) {
+        case LT:
+            if (startOrValue > maxValue) {
+                return true;
+            } else if (startOrValue <= minValue) {
+                return false;
+            }
+            break;
+        case LE:
+            if (startOrValue >= maxValue) {
+                return true;
+            } else if (startOrValue < minValue) {
+                return false;
+            }
+            break;
+        case GT:
+            if (startOrValue < minValue) {
+                return true;
+            } else if (startOrValue >= maxValue) {
+                return false;
+            }
+            break;
+        case GE:
+            if (startOrValue <= minValue) {
+                return true;
+            } else if (startOrValue > maxValue) {
+                return false;
+            }
+            break;
+        case EQ:
+            if (minValue == maxValue && minValue == startOrValue) {
+                return true;
+            } else if (startOrValue < minValue || startOrValue > maxValue) {
+                return false;
+            }
+            break;
+        case NEQ:
+            if (minValue == maxValue) {
+                return minValue != startOrValue;
+            } else if (startOrValue < minValue || startOrValue > maxValue) {
+                return true;
+            }
+            break;
+        case RANGE:
+            if (startOrValue <= minValue && end >= maxValue) {
+                return true;
+            } else if (startOrValue > maxValue || end < minValue) {
+                return false;
+            }
+            break;
+        default:
+            break;
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * Clamps a range to [minValue_, maxValue_] and moves the predicate into the stored domain
+     * (value - base_). Whatever compareUsingMinMax leaves to scan is not below minValue_, and so
+     * not below base_.
+     */
+    void toStoredPredicate(BsiOperation operation, uint64_t& start, uint64_t& end) const {
+        if (operation == RANGE) {
+            start = std::max(start, minValue_);
+            end = std::min(end, maxValue_) - base_;
+        }
+        start -= base_;
+    }
+
+    /**
+     * Where a compare applies foundSet. A selective foundSet is intersected with the ebm before
+     * the scan, so every slice step only touches its rows; a foundSet covering most of the
+     * population is cheaper to apply once to the (usually smaller) result. Returns the scan
+     * candidates and the filter still to be applied to the result, if any.
+     */
+    [[nodiscard]] auto compareScope(const Roaring64Map* foundSet,
+                                    Roaring64Map& filteredCandidates) const
+            -> std::pair<const Roaring64Map*, const Roaring64Map*> {
+        if (foundSet != nullptr && isSelective(*foundSet)) {
+            filteredCandidates = existenceBitMap_ & *foundSet;
+            return {&filteredCandidates, nullptr};
+        }
+        return {&existenceBitMap_, foundSet};
+    }
+
+    [[nodiscard]] auto isSelective(const Roaring64Map& foundSet) const -> bool {
+        return static_cast<double>(foundSet.cardinality()) <
+               foundSetPushDownRatio * static_cast<double>(existenceBitMap_.cardinality());
+    }
+
+    [[nodiscard]] static auto isCompareOperation(BsiOperation operation) -> bool {
+        return operation >= EQ && operation <= RANGE;
+    }
+
+    /**
+     * Runs a compare over 'candidates' and returns the matched rows. 'sliceAt(i)' returns slice i
+     * as a Bitmap, which is either a whole Roaring64Map or one 32-bit chunk of it.
+     */
+    template <typename Bitmap, typename SliceAt>
+    [[nodiscard]] auto compareBitmap(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                     const Bitmap& candidates, const Bitmap* lateFilter,
+                                     const SliceAt& sliceAt) const -> Bitmap {
+        Bitmap matched = unionOf(oNeilMatch(operation, startOrValue, end, candidates, sliceAt));
+        if (operation == NEQ) {
+            matched = candidates - matched;
+        }
+        if (lateFilter != nullptr) {
+            matched &= *lateFilter;
+        }
+        return matched;
+    }
+
+    template <typename Bitmap, typename SliceAt>
+    [[nodiscard]] auto countBitmap(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                   const Bitmap& candidates, const Bitmap* lateFilter,
+                                   const SliceAt& sliceAt) const -> uint64_t {
+        // the parts are disjoint, so their counts add up
+        auto countOf = [lateFilter](const Bitmap& bitmap) -> uint64_t {
+            return lateFilter != nullptr ? bitmap.and_cardinality(*lateFilter)
+                                         : bitmap.cardinality();
+        };
+        uint64_t count = 0;
+        for (const auto& part : oNeilMatch(operation, startOrValue, end, candidates, sliceAt)) {
+            count += countOf(part);
+        }
+        if (operation == NEQ) {
+            return countOf(candidates) - count;
+        }
+        return count;
+    }
+
+    /**
+     * Runs the O'Neil kernel of 'operation' over 'candidates' and returns the matched rows as
+     * disjoint parts (for NEQ: the EQ rows, which the caller takes the complement of).
+     */
+    template <typename Bitmap, typename SliceAt>
+    [[nodiscard]] auto oNeilMatch(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                  const Bitmap& candidates, const SliceAt& sliceAt) const
+            -> MatchedParts<Bitmap> {
+        switch (operation) {
+        case EQ:
+        case NEQ:
+            return oNeilKernel<EQ>(candidates, startOrValue, sliceAt);
+        case GE:
+            return oNeilKernel<GE>(candidates, startOrValue, sliceAt);
+        case GT:
+            // v > c  <=>  v >= c + 1
+            if (startOrValue == UINT64_MAX) {
+                return {};
+            }
+            return oNeilKernel<GE>(candidates, startOrValue + 1, sliceAt);
+        case LE:
+            return oNeilKernel<LE>(candidates, startOrValue, sliceAt);
+        case LT:
+            // v < c  <=>  v <= c - 1
+            if (startOrValue == 0) {
+                return {};
+            }
+            return oNeilKernel<LE>(candidates, startOrValue - 1, sliceAt);
+        case RANGE:
+            return oNeilRangeKernel(candidates, startOrValue, end, sliceAt);
+        default:
+            return {};
+        }
+    }
+
+    /**
+     * IN-list kernel over the binary trie of the sorted stored 'values', which agree on every bit
+     * above 'bit' and share 'rows'. A node whose values all have the same bit narrows the rows
+     * with one slice operation; a node where they differ splits the rows once and recurses into
+     * the ones. Each leaf is the (disjoint) rows of one value and is appended to 'parts'.
+     */
+    template <typename Bitmap, typename SliceAt>
+    static void inTrie(Bitmap rows, std::span<const uint64_t> values, int32_t bit,
+                       const SliceAt& sliceAt, MatchedParts<Bitmap>& parts) {
+        for (; bit >= 0 && !rows.isEmpty(); bit--) {
+            // sorted values that agree above 'bit' have the ones at 'bit' last
+            auto isZero = [bit](uint64_t value) { return ((value >> bit) & 1) == 0; };
+            const auto zeros = static_cast<size_t>(
+                    std::partition_point(values.begin(), values.end(), isZero) - values.begin());
+            if (zeros == values.size()) {
+                rows -= sliceAt(bit);
+            } else if (zeros == 0) {
+                rows &= sliceAt(bit);
+            } else {
+                Bitmap ones = rows & sliceAt(bit);
+                rows -= ones;
+                inTrie(std::move(ones), values.subspan(zeros), bit - 1, sliceAt, parts);
+                values = values.first(zeros);
+            }
+        }
+        if (!rows.isEmpty()) {
+            parts.emplace_back(std::move(rows));
+        }
+    }
+
+    /**
+     * Histogram kernel over the stored values prefix .. prefix | lowBits(bit), held by 'rows' (of
+     * the given cardinality). A node within one bucket only adds its cardinality; a node
+     * straddling a boundary is split on slice 'bit', and when each half then lies within one
+     * bucket a single and_cardinality settles both without materializing them. Otherwise the
+     * halves straddling a boundary are followed (the ones recursively), each at the cost of one
+     * slice operation when the other half lies within one bucket.
+     */
+    template <typename Bitmap, typename SliceAt>
+    static void histogramNode(Bitmap rows, uint64_t cardinality, uint64_t prefix, int32_t bit,
+                              std::span<const uint64_t> boundaries, const SliceAt& sliceAt,
+                              std::vector<uint64_t>& counts) {
+        while (cardinality > 0) {
+            const size_t lowBucket = bucketOf(boundaries, prefix);
+            if (lowBucket == bucketOf(boundaries, prefix | lowBits(bit))) {
+                counts[lowBucket] += cardinality;
+                return;
+            }
+
+            const uint64_t middle = prefix | (1UL << bit);
+            const size_t highBucket = bucketOf(boundaries, middle);
+            const bool zerosSplit = lowBucket != bucketOf(boundaries, middle - 1);
+            const bool onesSplit = highBucket != bucketOf(boundaries, middle | lowBits(bit - 1));
+            if (!zerosSplit && !onesSplit) {
+                const uint64_t ones = rows.and_cardinality(sliceAt(bit));
+                counts[lowBucket] += cardinality - ones;
+                counts[highBucket] += ones;
+                return;
+            }
+
+            // the half within one bucket only needs its cardinality: the rows minus the other half
+            if (!zerosSplit) {
+                rows &= sliceAt(bit);
+                const uint64_t onesCardinality = rows.cardinality();
+                counts[lowBucket] += cardinality - onesCardinality;
+                cardinality = onesCardinality;
+                prefix = middle;
+            } else if (!onesSplit) {
+                rows -= sliceAt(bit);
+                const uint64_t zerosCardinality = rows.cardinality();
+                counts[highBucket] += cardinality - zerosCardinality;
+                cardinality = zerosCardinality;
+            } else {
+                Bitmap ones = rows & sliceAt(bit);
+                rows -= sliceAt(bit);
+                const uint64_t onesCardinality = ones.cardinality();
+                histogramNode(std::move(ones), onesCardinality, middle, bit - 1, boundaries,
+                              sliceAt, counts);
+                cardinality -= onesCardinality;
+            }
+            bit--;
+        }
+    }
+
+    // the bucket of a stored value: the number of (stored) boundaries not above it
+    static auto bucketOf(std::span<const uint64_t> boundaries, uint64_t value) -> size_t {
+        return std::upper_bound(boundaries.begin(), boundaries.end(), value) - boundaries.begin();
+    }
+
+    // bits 0..bit set; none for a negative bit
+    static auto lowBits(int32_t bit) -> uint64_t {
+        if (bit < 0) {
+            return 0;
+        }
+        return bit >= static_cast<int32_t>(maxBitDepth) - 1 ? UINT64_MAX : (1UL << (bit + 1)) - 1;
+    }
+
+    template <typename Bitmap>
+    static auto unionOf(MatchedParts<Bitmap>&& parts) -> Bitmap {
+        if (parts.empty()) {
+            return {};
+        }
+        Bitmap result = std::move(parts[0]);
+        for (size_t i = 1; i < parts.size(); i++) {
+            result |= parts[i];
+        }
+        return result;
+    }
+
+    /**
+     * O'Neil top-down scan over 'candidates' specialized per operation, so that only the
+     * accumulators the predicate needs are maintained:
+     *   EQ: the equality chain only;
+     *   GE: the equality chain plus gt, stopping at the lowest set bit of the predicate
+     *       (below it every remaining equal row is >= predicate whatever its low bits are);
+     *   LE: the equality chain plus lt, stopping at the lowest clear bit of the predicate.
+     * GT and LT are rewritten by the caller as GE c+1 and LE c-1.
+     */
+    template <BsiOperation operation, typename Bitmap, typename SliceAt>
+    [[nodiscard]] auto oNeilKernel(const Bitmap& candidates, uint64_t predicate,
+                                   const SliceAt& sliceAt) const -> MatchedParts<Bitmap> {
+        // every stored value fits in bitCount() bits
+        if (getBitDepth(predicate) > bitCount()) {
+            if constexpr (operation == LE) {
+                MatchedParts<Bitmap> parts;
+                parts.emplace_back(candidates);
+                return parts;
+            }
+            return {};
+        }
+
+        return oNeilScan<operation>(candidates, predicate, static_cast<int32_t>(bitCount()) - 1,
+                                    sliceAt);
+    }
+
+    /**
+     * Single top-down pass for start <= v <= end. The high bits shared by start and end are one
+     * equality chain; at the first differing bit (0 in start, 1 in end) the rows split into a
+     * lower half that only needs the GE start test and an upper half that only needs LE end,
+     * and the two halves are disjoint.
+     */
+    template <typename Bitmap, typename SliceAt>
+    [[nodiscard]] auto oNeilRangeKernel(const Bitmap& candidates, uint64_t start, uint64_t end,
+                                        const SliceAt& sliceAt) const -> MatchedParts<Bitmap> {
+        if (start > end || getBitDepth(start) > bitCount()) {
+            return {};
+        }
+        if (getBitDepth(end) > bitCount()) {
+            return oNeilKernel<GE>(candidates, start, sliceAt);
+        }
+        if (start == end) {
+            return oNeilKernel<EQ>(candidates, start, sliceAt);
+        }
+
+        const auto splitBit = static_cast<int32_t>(std::bit_width(start ^ end)) - 1;
+
+        Bitmap eqBitMap = candidates;
+        for (int32_t i = bitCount() - 1; i > splitBit && !eqBitMap.isEmpty(); i--) {
+            if (((start >> i) & 1) == 1) {
+                eqBitMap &= sliceAt(i);
+            } else {
+                eqBitMap -= sliceAt(i);
+            }
+        }
+
+        Bitmap upperBitMap = eqBitMap & sliceAt(splitBit);
+        eqBitMap -= sliceAt(splitBit);
+
+        auto parts = oNeilScan<GE>(std::move(eqBitMap), start, splitBit - 1, sliceAt);
+        for (auto& part : oNeilScan<LE>(std::move(upperBitMap), end, splitBit - 1, sliceAt)) {
+            parts.emplace_back(std::move(part));
+        }
+        return parts;
+    }
+
+    /**
+     * Runs the kernel of 'operation' over slices topBit..0, for rows whose higher bits already
+     * equal those of the predicate. GE and LE return the strictly greater / less rows and the
+     * equal rows as separate parts.
+     */
+    template <BsiOperation operation, typename Bitmap, typename SliceAt>
+    [[nodiscard]] static auto oNeilScan(Bitmap eqBitMap, uint64_t predicate, int32_t topBit,
+                                        const SliceAt& sliceAt) -> MatchedParts<Bitmap> {
+        static_assert(operation == EQ || operation == GE || operation == LE,
+                      "oNeilScan only implements EQ, GE and LE");
+
+        MatchedParts<Bitmap> parts;
+        if (topBit < 0) {
+            parts.emplace_back(std::move(eqBitMap));
+            return parts;
+        }
+        if (topBit < static_cast<int32_t>(maxBitDepth) - 1) {
+            predicate &= (1UL << (topBit + 1)) - 1;
+        }
+
+        if constexpr (operation == EQ) {
+            for (int32_t i = topBit; i >= 0 && !eqBitMap.isEmpty(); i--) {
+                if (((predicate >> i) & 1) == 1) {
+                    eqBitMap &= sliceAt(i);
+                } else {
+                    eqBitMap -= sliceAt(i);
+                }
+            }
+        } else if constexpr (operation == GE) {
+            Bitmap gtBitMap;
+            const auto lowestBit =
+                    predicate == 0 ? topBit + 1 : static_cast<int32_t>(std::countr_zero(predicate));
+            for (int32_t i = topBit; i >= lowestBit && !eqBitMap.isEmpty(); i--) {
+                if (((predicate >> i) & 1) == 1) {
+                    eqBitMap &= sliceAt(i);
+                } else {
+                    gtBitMap |= (eqBitMap & sliceAt(i));
+                    eqBitMap -= sliceAt(i);
+                }
+            }
+            parts.emplace_back(std::move(gtBitMap));
+        } else {
+            Bitmap ltBitMap;
+            const auto lowestBit = static_cast<int32_t>(std::countr_one(predicate));
+            for (int32_t i = topBit; i >= lowestBit && !eqBitMap.isEmpty(); i--) {
+                if (((predicate >> i) & 1) == 1) {
+                    ltBitMap |= (eqBitMap - sliceAt(i));
+                    eqBitMap &= sliceAt(i);
+                } else {
+                    eqBitMap -= sliceAt(i);
+                }
+            }
+            parts.emplace_back(std::move(ltBitMap));
+        }
+
+        parts.emplace_back(std::move(eqBitMap));
+        return parts;
+    }
+
+    /**
+     * Slice accessor for the 32-bit chunk 'key' of every slice; slices without that chunk read
+     * as empty.
+     */
+    [[nodiscard]] auto chunkSlices(uint32_t key) const -> ChunkSlices {
+        ChunkSlices slices {std::vector<const Roaring*>(bitCount())};
+        for (size_t i = 0; i < bitCount(); i++) {
+            slices.chunks[i] = &chunkOf(slice(i), key);
+        }
+        return slices;
+    }
+
+    [[nodiscard]] auto wholeSlices() const -> WholeSlices { return WholeSlices {this}; }
+
+    static auto emptyChunk() -> const Roaring& {
+        static const Roaring empty;
+        return empty;
+    }
+
+    static auto chunkOf(const Roaring64Map& bitmap, uint32_t key) -> const Roaring& {
+        const auto& roarings = bitmap.getRoarings();
+        auto it = roarings.find(key);
+        return it != roarings.end() ? it->second : emptyChunk();
+    }
+
+    [[nodiscard]] auto runsParallel(size_t chunkCount) const -> bool {
+        return threadPool_ != nullptr && threadPool_->size() > 1 && chunkCount > 1;
+    }
+
+    /**
+     * Splits [0, count) into contiguous ranges and runs fn(begin, end) on the thread pool.
+     */
+    void parallelRanges(size_t count, const std::function<void(size_t, size_t)>& fn) const {
+        const size_t tasks = std::min(count, threadPool_->size() * parallelTasksPerThread);
+        threadPool_->parallelFor(tasks, [&](size_t task) {
+            fn(count * task / tasks, count * (task + 1) / tasks);
+        });
+    }
+
+    /**
+     * The candidate chunks a compare still has to look at, each with whether its zone already
+     * says that all of its rows match; the chunks whose zone rules out every row are left out.
+     */
+    [[nodiscard]] auto zonedChunks(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                   const Roaring64Map& candidates) const
+            -> std::vector<std::tuple<uint32_t, const Roaring*, bool>> {
+        auto zones = chunkZones();
+        std::vector<std::tuple<uint32_t, const Roaring*, bool>> chunks;
+        for (const auto& [key, chunk] : candidates.getRoarings()) {
+            const ChunkZone* zone = zoneOf(*zones, key);
+            if (zone == nullptr || chunk.isEmpty()) {
+                continue;
+            }
+            auto allMatch =
+                    decideByBounds(operation, startOrValue, end, zone->minValue, zone->maxValue);
+            if (allMatch.value_or(true)) {
+                chunks.emplace_back(key, &chunk, allMatch.has_value());
+            }
+        }
+        return chunks;
+    }
+
+    // Runs fn(c) for c in [0, count), spread over the thread pool if there is one.
+    void forEachChunk(size_t count, const std::function<void(size_t)>& fn) const {
+        auto run = [&fn](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; c++) {
+                fn(c);
+            }
+        };
+        if (runsParallel(count)) {
+            parallelRanges(count, run);
+        } else {
+            run(0, count);
+        }
+    }
+
+    /**
+     * Chunk-wise compare: chunks decided by their zone are taken whole or skipped, the others
+     * are scanned on their own, and the 32-bit results are stitched back in key order.
+     * startOrValue / end are the values of the query, not yet in the stored domain.
+     */
+    [[nodiscard]] auto chunkedCompare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                      const Roaring64Map& candidates,
+                                      const Roaring64Map* lateFilter) const -> Roaring64Map {
+        auto chunks = zonedChunks(operation, startOrValue, end, candidates);
+        toStoredPredicate(operation, startOrValue, end);
+
+        std::vector<Roaring> results(chunks.size());
+        forEachChunk(chunks.size(), [&](size_t c) {
+            const auto [key, chunk, allMatch] = chunks[c];
+            const Roaring* chunkFilter =
+                    lateFilter != nullptr ? &chunkOf(*lateFilter, key) : nullptr;
+            if (!allMatch) {
+                results[c] = compareBitmap(operation, startOrValue, end, *chunk, chunkFilter,
+                                           chunkSlices(key));
+            } else if (chunkFilter != nullptr) {
+                results[c] = *chunk & *chunkFilter;
+            } else {
+                results[c] = *chunk;
+            }
+        });
+
+        Roaring64Map matched;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            matched.setRoaring(std::get<0>(chunks[c]), std::move(results[c]));
+        }
+        return matched;
+    }
+
+    /**
+     * compareIn chunk by chunk: a chunk only walks the trie of the values within its zone.
+     */
+    [[nodiscard]] auto chunkedIn(std::span<const uint64_t> values, const Roaring64Map& candidates,
+                                 const Roaring64Map* lateFilter) const -> Roaring64Map {
+        auto zones = chunkZones();
+        std::vector<std::tuple<uint32_t, const Roaring*, std::span<const uint64_t>>> chunks;
+        for (const auto& [key, chunk] : candidates.getRoarings()) {
+            const ChunkZone* zone = zoneOf(*zones, key);
+            if (zone == nullptr || chunk.isEmpty()) {
+                continue;
+            }
+            auto first = std::lower_bound(values.begin(), values.end(), zone->minValue - base_);
+            auto last = std::upper_bound(first, values.end(), zone->maxValue - base_);
+            if (first != last) {
+                chunks.emplace_back(key, &chunk, std::span<const uint64_t>(first, last));
+            }
+        }
+
+        std::vector<Roaring> results(chunks.size());
+        forEachChunk(chunks.size(), [&](size_t c) {
+            const auto& [key, chunk, chunkValues] = chunks[c];
+            MatchedParts<Roaring> parts;
+            inTrie(*chunk, chunkValues, static_cast<int32_t>(bitCount()) - 1, chunkSlices(key),
+                   parts);
+            results[c] = unionOf(std::move(parts));
+            if (lateFilter != nullptr) {
+                results[c] &= chunkOf(*lateFilter, key);
+            }
+        });
+
+        Roaring64Map matched;
+        for (size_t c = 0; c < chunks.size(); c++) {
+            matched.setRoaring(std::get<0>(chunks[c]), std::move(results[c]));
+        }
+        return matched;
+    }
+
+    [[nodiscard]] auto chunkedCount(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                    const Roaring64Map& candidates,
+                                    const Roaring64Map* lateFilter) const -> uint64_t {
+        auto chunks = zonedChunks(operation, startOrValue, end, candidates);
+        toStoredPredicate(operation, startOrValue, end);
+
+        std::vector<uint64_t> counts(chunks.size());
+        forEachChunk(chunks.size(), [&](size_t c) {
+            const auto [key, chunk, allMatch] = chunks[c];
+            const Roaring* chunkFilter =
+                    lateFilter != nullptr ? &chunkOf(*lateFilter, key) : nullptr;
+            if (!allMatch) {
+                counts[c] = countBitmap(operation, startOrValue, end, *chunk, chunkFilter,
+                                        chunkSlices(key));
+            } else if (chunkFilter != nullptr) {
+                counts[c] = chunk->and_cardinality(*chunkFilter);
+            } else {
+                counts[c] = chunk->cardinality();
+            }
+        });
+        return std::accumulate(counts.begin(), counts.end(), uint64_t {0});
+    }
+
+    /**
+     * Chunk-wise histogram: a chunk whose zone lies within one bucket only adds its
+     * cardinality, the others run the kernel on their own chunk of every slice.
+     */
+    void chunkedHistogram(std::span<const uint64_t> boundaries, const Roaring64Map& rows,
+                          std::vector<uint64_t>& counts) const {
+        auto zones = chunkZones();
+        std::vector<std::pair<uint32_t, const Roaring*>> chunks;
+        for (const auto& [key, chunk] : rows.getRoarings()) {
+            const ChunkZone* zone = zoneOf(*zones, key);
+            if (zone == nullptr || chunk.isEmpty()) {
+                continue;
+            }
+            const size_t bucket = bucketOf(boundaries, zone->minValue - base_);
+            if (bucket == bucketOf(boundaries, zone->maxValue - base_)) {
+                counts[bucket] += chunk.cardinality();
+            } else {
+                chunks.emplace_back(key, &chunk);
+            }
+        }
+
+        std::vector<std::vector<uint64_t>> chunkCounts(chunks.size(),
+                                                       std::vector<uint64_t>(counts.size()));
+        forEachChunk(chunks.size(), [&](size_t c) {
+            const auto [key, chunk] = chunks[c];
+            histogramNode(*chunk, chunk->cardinality(), 0, static_cast<int32_t>(bitCount()) - 1,
+                          boundaries, chunkSlices(key), chunkCounts[c]);
+        });
+        for (const auto& chunkCount : chunkCounts) {
+            for (size_t b = 0; b < counts.size(); b++) {
+                counts[b] += chunkCount[b];
+            }
+        }
+    }
+
+    /**
+     * Chunk-wise sum: a chunk whose rows all take part is summed from its zone, as is a chunk
+     * holding a single value; only the others intersect foundSet with their slices.
+     */
+    [[nodiscard]] auto chunkedSum(const Roaring64Map& foundSet) const
+            -> std::tuple<unsigned __int128, uint64_t> {
+        auto zones = chunkZones();
+        std::vector<std::tuple<uint32_t, const Roaring*, const ChunkZone*>> chunks;
+        for (const auto& [key, chunk] : foundSet.getRoarings()) {
+            if (const ChunkZone* zone = zoneOf(*zones, key); zone != nullptr) {
+                chunks.emplace_back(key, &chunk, zone);
+            }
+        }
+
+        std::vector<unsigned __int128> sums(chunks.size());
+        std::vector<uint64_t> counts(chunks.size());
+        forEachChunk(chunks.size(), [&](size_t c) {
+            const auto [key, chunk, zone] = chunks[c];
+            const uint64_t rows = chunk->and_cardinality(chunkOf(existenceBitMap_, key));
+            counts[c] = rows;
+            if (rows == zone->cardinality) {
+                sums[c] = zone->storedSum;
+            } else if (zone->minValue == zone->maxValue) {
+                sums[c] = static_cast<unsigned __int128>(zone->minValue - base_) * rows;
+            } else if (rows > 0) {
+                auto sliceAt = chunkSlices(key);
+                sums[c] = weightedSum(bitCount(), rows,
+                                      [&](size_t i) { return sliceAt(i).and_cardinality(*chunk); });
+            }
+        });
+        const auto sum =
+                std::accumulate(sums.begin(), sums.end(), static_cast<unsigned __int128>(0));
+        return std::make_tuple(sum, std::accumulate(counts.begin(), counts.end(), uint64_t {0}));
+    }
+
+    /**
+     * Drops the candidate chunks that cannot hold any of the k largest values. Taking whole
+     * chunks by descending zone minimum until they hold k candidates gives a value L with at
+     * least k candidates at or above it, so a chunk whose zone maximum is below L is out.
+     */
+    void pruneTopKChunks(uint64_t k, Roaring64Map& candidates) const {
+        auto zones = chunkZones();
+        std::vector<std::pair<const ChunkZone*, uint64_t>> chunks;
+        for (const auto& [key, chunk] : candidates.getRoarings()) {
+            if (const ChunkZone* zone = zoneOf(*zones, key); zone != nullptr) {
+                chunks.emplace_back(zone, chunk.cardinality());
+            }
+        }
+        std::sort(chunks.begin(), chunks.end(), [](const auto& left, const auto& right) {
+            return left.first->minValue > right.first->minValue;
+        });
+
+        uint64_t covered = 0;
+        for (const auto& [zone, cardinality] : chunks) {
+            covered += cardinality;
+            if (covered < k) {
+                continue;
+            }
+            const uint64_t floor = zone->minValue;
+            for (const auto& [other, unused] : chunks) {
+                if (other->maxValue < floor) {
+                    candidates.setRoaring(other->key, Roaring {});
+                }
+            }
+            return;
+        }
+    }
+
+    /**
+     * Chunk-parallel topK: the per-slice decision needs the global count, so every slice step
+     * counts all chunks in parallel, then narrows all chunks in parallel.
+     */
+    [[nodiscard]] auto parallelTopK(uint64_t k, const Roaring64Map& candidateSet) const
+            -> Roaring64MapPtr {
+        std::vector<uint32_t> keys;
+        std::vector<Roaring> candidates;
+        for (const auto& [key, chunk] : candidateSet.getRoarings()) {
+            keys.emplace_back(key);
+            candidates.emplace_back(chunk);
+        }
+        std::vector<Roaring> selected(keys.size());
+        std::vector<uint64_t> counts(keys.size());
+
+        uint64_t remaining = candidateSet.cardinality();
+        for (int32_t x = bitCount() - 1; x >= 0 && remaining > 0 && k > 0; x--) {
+            const auto& slice = this->slice(x);
+            parallelRanges(keys.size(), [&](size_t begin, size_t stop) {
+                for (size_t c = begin; c < stop; c++) {
+                    counts[c] = candidates[c].and_cardinality(chunkOf(slice, keys[c]));
+                }
+            });
+            uint64_t cardinality = std::accumulate(counts.begin(), counts.end(), uint64_t {0});
+
+            const bool narrow = cardinality > k;
+            parallelRanges(keys.size(), [&](size_t begin, size_t stop) {
+                for (size_t c = begin; c < stop; c++) {
+                    const Roaring& sliceChunk = chunkOf(slice, keys[c]);
+                    if (narrow) {
+                        candidates[c] &= sliceChunk;
+                    } else {
+                        selected[c] |= candidates[c] & sliceChunk;
+                        candidates[c] -= sliceChunk;
+                    }
+                }
+            });
+            if (narrow) {
+                remaining = cardinality;
+            } else {
+                remaining -= cardinality;
+                k -= cardinality;
+            }
+        }
+
+        // not enough rows selected yet: the remaining candidates all tie, take them in id order
+        for (size_t c = 0; c < keys.size() && k > 0; c++) {
+            uint64_t cardinality = candidates[c].cardinality();
+            if (cardinality <= k) {
+                selected[c] |= candidates[c];
+                k -= cardinality;
+            } else {
+                uint32_t last = 0;
+                candidates[c].select(k - 1, &last);
+                candidates[c].removeRange(uint64_t {last} + 1, uint64_t {1} << 32);
+                selected[c] |= candidates[c];
+                k = 0;
+            }
+        }
+
+        Roaring64MapPtr retBitmap = std::make_unique<Roaring64Map>();
+        for (size_t c = 0; c < keys.size(); c++) {
+            retBitmap->setRoaring(keys[c], std::move(selected[c]));
+        }
+        return retBitmap;
+    }
+
+    /**
+     * New index with the given ebm and slices sliceFn(slice(i)), computed slice-parallel when a
+     * thread pool is set. Only the result is materialized; min/max are carried over as is.
+     */
+    [[nodiscard]] auto derive(Roaring64Map&& existenceBitMap,
+                              const std::function<Roaring64Map(const Roaring64Map&)>& sliceFn)
+            const -> Roaring64BsiPtr {
+        refreshMinMax();
+        auto newBsiPtr = std::make_unique<Roaring64Bsi>();
+        newBsiPtr->minValue_ = minValue_;
+        newBsiPtr->maxValue_ = maxValue_;
+        newBsiPtr->frameOfReference_ = frameOfReference_;
+        newBsiPtr->base_ = base_;
+        newBsiPtr->runOptimized_ = runOptimized_;
+        newBsiPtr->copyOnWrite_ = copyOnWrite_;
+        newBsiPtr->threadPool_ = threadPool_;
+        newBsiPtr->existenceBitMap_ = std::move(existenceBitMap);
+        newBsiPtr->indexBitMapVec_.resize(bitCount());
+
+        auto& slices = newBsiPtr->indexBitMapVec_;
+        if (threadPool_ != nullptr && threadPool_->size() > 1) {
+            threadPool_->parallelFor(bitCount(), [&](size_t i) { slices[i] = sliceFn(slice(i)); });
+        } else {
+            for (size_t i = 0; i < bitCount(); i++) {
+                slices[i] = sliceFn(slice(i));
+            }
+        }
+        return newBsiPtr;
+    }
+
+    static auto leadingZeroes(uint64_t value) -> size_t {
+        return (value < 1) ? maxBitDepth : __builtin_clzll(value);
+    }
+
+    static auto getBitDepth(uint64_t value) -> size_t { return maxBitDepth - leadingZeroes(value); }
+
+    // bounds of the values, stale while minMaxDirty_ (see refreshMinMax)
+    mutable uint64_t maxValue_ {0};
+    mutable uint64_t minValue_ {0};
+    bool runOptimized_ {false};
+    bool deferMinMax_ {false};
+    mutable std::atomic<bool> minMaxDirty_ {false};
+    mutable std::mutex minMaxMutex_;
+    // per-chunk zones, see chunkZones(); never copied along with the index
+    mutable std::shared_ptr<std::vector<ChunkZone>> zones_;
+    mutable std::mutex zonesMutex_;
+    // queries that went without zones, see usesZones()
+    mutable std::atomic<uint64_t> zonelessQueries_ {0};
+    // set on frozenView indexes, whose bitmaps are views of the caller's buffer
+    bool frozen_ {false};
+    // copies share the slices through sharedSlices_, see setCopyOnWrite
+    bool copyOnWrite_ {false};
+    // with frameOfReference_ the slices hold value - base_; base_ is 0 otherwise
+    bool frameOfReference_ {false};
+    uint64_t base_ {0};
+
+    // mutable as copying a copy-on-write index moves them into sharedSlices_
+    mutable std::vector<Roaring64Map> indexBitMapVec_;
     Roaring64Map existenceBitMap_;
+    std::shared_ptr<ThreadPool> threadPool_;
+    // set while slices of a deserializeLazy buffer may still be unparsed; shared by copies
+    std::shared_ptr<LazySlices> lazySlices_;
+    // set while the slices are shared with copies under copy-on-write, see shareSlices()
+    mutable std::shared_ptr<std::vector<Roaring64Map>> sharedSlices_;
 
     constexpr static size_t maxBitDepth {64};
+    // queries without zones after which building them pays off, see usesZones()
+    constexpr static uint64_t zoneBuildQueries {32};
+    // chunk ranges handed out per pool thread, to even out uneven chunks
+    constexpr static size_t parallelTasksPerThread {4};
+    // frozen bitmaps must start on 32-byte boundaries
+    constexpr static size_t frozenAlignment {32};
+    constexpr static std::string_view frozenMagic {"BSIFRZ01"};
+    constexpr static std::string_view indexedMagic {"BSIIDX\0\0", 8};
+    // version 2 adds the frame-of-reference base; indexes without one are still written as 1
+    constexpr static uint32_t indexedVersion {2};
+    // option / header flag: the 8-byte base follows the header
+    constexpr static uint32_t frameOfReferenceFlag {2};
+    // option flag of serialize: the slices are range encoded (Roaring64RangeBsi)
+    constexpr static uint32_t rangeEncodedFlag {4};
+    // transposeWithCount partitions the rows on the slices up to this bit depth
+    constexpr static size_t histogramPartitionDepth {8};
+    // digit width of the radix sort behind transposeWithCount
+    constexpr static size_t radixSortBits {11};
+    // ids buffered per slice before the bulk loader flushes them with addMany
+    constexpr static size_t bulkFlushSize {4096};
+    // foundSet is pushed down into the scan when it holds fewer rows than this share of the ebm
+    constexpr static double foundSetPushDownRatio {0.5};
+    // groupSum decodes a chunk once instead of intersecting every group with it from this many
+    // groups with rows in the chunk on
+    constexpr static size_t groupSumDecodeThreshold {16};
 };
 
 } // namespace roaring
@@ -0,0 +1,99 @@
+// Roaring64BsiView: 通过 mmap 只读打开冻结格式(Roaring64Bsi::writeFrozen)的BSI文件，不拷贝切片数据。
+
+#ifndef INCLUDE_ROARING_64_BITMAP_SLICE_INDEX_VIEW_HH_
+#define INCLUDE_ROARING_64_BITMAP_SLICE_INDEX_VIEW_HH_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "roaring64bsi.hh"
+
+namespace roaring {
+
+class Roaring64BsiView {
+public:
+    using Roaring64BsiViewPtr = std::unique_ptr<Roaring64BsiView>;
+
+    /**
+   * bsi_view_write: 将BSI以冻结格式写入文件 path，成功返回 true。
+   */
+    static auto write(const Roaring64Bsi& bsi, const std::string& path) -> bool {
+        const size_t size = bsi.frozenSizeInBytes();
+        // writeFrozen needs a 32-byte aligned buffer; aligned_alloc wants a multiple of it
+        std::unique_ptr<char, decltype(&std::free)> buffer(
+                static_cast<char*>(std::aligned_alloc(32, (size + 31) / 32 * 32)), &std::free);
+        if (buffer == nullptr) {
+            return false;
+        }
+        bsi.writeFrozen(buffer.get());
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(buffer.get(), static_cast<std::streamsize>(size));
+        return out.good();
+    }
+
+    /**
+   * bsi_view_open: 以只读共享方式 mmap 文件 path 并在其上构造BSI，切片直接引用映射的内存，
+   * 打开时不读取切片数据，多个进程打开同一文件时共享页缓存。文件不存在或格式不合法时返回 nullptr。
+   */
+    static auto open(const std::string& path) -> Roaring64BsiViewPtr {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return nullptr;
+        }
+        const auto length = static_cast<size_t>(st.st_size);
+        void* data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+
+        auto bsi = Roaring64Bsi::frozenView(static_cast<const char*>(data), length);
+        if (bsi == nullptr) {
+            ::munmap(data, length);
+            return nullptr;
+        }
+        return Roaring64BsiViewPtr(new Roaring64BsiView(data, length, std::move(bsi)));
+    }
+
+    Roaring64BsiView(const Roaring64BsiView&) = delete;
+    auto operator=(const Roaring64BsiView&) -> Roaring64BsiView& = delete;
+
+    ~Roaring64BsiView() {
+        // the frozen slices point into the mapping, drop them first
+        bsi_.reset();
+        ::munmap(data_, length_);
+    }
+
+    // 只读访问：compare/countCompare/sum/topK/getValues 等 const 接口
+    auto operator*() const -> const Roaring64Bsi& { return *bsi_; }
+    auto operator->() const -> const Roaring64Bsi* { return bsi_.get(); }
+
+    void setThreadPool(std::shared_ptr<ThreadPool> threadPool) {
+        bsi_->setThreadPool(std::move(threadPool));
+    }
+
+private:
+    Roaring64BsiView(void* data, size_t length, std::unique_ptr<Roaring64Bsi> bsi)
+            : data_ {data}, length_ {length}, bsi_ {std::move(bsi)} {}
+
+    void* data_;
+    size_t length_;
+    std::unique_ptr<Roaring64Bsi> bsi_;
+};
+
+} // namespace roaring
+
+#endif /*INCLUDE_ROARING_64_BITMAP_SLICE_INDEX_VIEW_HH_*/
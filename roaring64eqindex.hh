@@ -0,0 +1,332 @@
+// Roaring64EqIndex: 等值编码的位图索引，每个不同的值对应一个roaringbitmap，适合取值个数很少的列
+// (国家、设备类型、套餐等级等)。EQ 只需一次查找，IN 列表与范围查询是若干位图的 fastunion。
+
+#ifndef INCLUDE_ROARING_64_EQUALITY_INDEX_HH_
+#define INCLUDE_ROARING_64_EQUALITY_INDEX_HH_
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <span>
+#include <tuple>
+#include <vector>
+
+#include "roaring.hh"
+#include "roaring64bsi.hh"
+
+namespace roaring {
+
+class Roaring64EqIndex {
+    using Roaring64MapPtr = std::unique_ptr<Roaring64Map>;
+
+public:
+    void setValue(uint64_t columnId, uint64_t value) {
+        if (existenceBitMap_.contains(columnId)) {
+            for (auto it = bitmaps_.begin(); it != bitmaps_.end(); ++it) {
+                if (it->second.removeChecked(columnId)) {
+                    if (it->second.isEmpty()) {
+                        bitmaps_.erase(it);
+                    }
+                    break;
+                }
+            }
+        }
+        existenceBitMap_.add(columnId);
+        bitmaps_[value].add(columnId);
+    }
+
+    /**
+   * bsi_eq_set_values: 批量设置 (columnId, value)，同一 columnId 以最后一行为准，与 setValue 相同。
+   * 按值分组后每个值的位图只做一次 addMany。
+   */
+    void setValues(const std::vector<std::tuple<uint64_t, uint64_t>>& vec) {
+        if (vec.empty()) {
+            return;
+        }
+
+        // a later row for the same columnId overwrites the earlier ones, as with setValue: reversed
+        // and stably sorted, the row written last comes first among equal columnIds
+        std::vector<std::tuple<uint64_t, uint64_t>> rows(vec.rbegin(), vec.rend());
+        std::stable_sort(rows.begin(), rows.end(), [](const auto& left, const auto& right) {
+            return std::get<0>(left) < std::get<0>(right);
+        });
+        rows.erase(std::unique(rows.begin(), rows.end(),
+                               [](const auto& left, const auto& right) {
+                                   return std::get<0>(left) == std::get<0>(right);
+                               }),
+                   rows.end());
+
+        std::vector<uint64_t> columnIds;
+        columnIds.reserve(rows.size());
+        for (const auto& row : rows) {
+            columnIds.push_back(std::get<0>(row));
+        }
+        Roaring64Map ids;
+        ids.addMany(columnIds.size(), columnIds.data());
+        auto overwritten = existenceBitMap_ & ids;
+        if (!overwritten.isEmpty()) {
+            removeRows(overwritten);
+        }
+        existenceBitMap_ |= ids;
+
+        // stable by value keeps each group's columnIds ascending for addMany
+        std::stable_sort(rows.begin(), rows.end(), [](const auto& left, const auto& right) {
+            return std::get<1>(left) < std::get<1>(right);
+        });
+        for (size_t begin = 0; begin < rows.size();) {
+            const uint64_t value = std::get<1>(rows[begin]);
+            columnIds.clear();
+            size_t end = begin;
+            for (; end < rows.size() && std::get<1>(rows[end]) == value; end++) {
+                columnIds.push_back(std::get<0>(rows[end]));
+            }
+            bitmaps_[value].addMany(columnIds.size(), columnIds.data());
+            begin = end;
+        }
+    }
+
+    [[nodiscard]] auto getValue(uint64_t columnId) const noexcept -> std::tuple<uint64_t, bool> {
+        if (existenceBitMap_.contains(columnId)) {
+            for (const auto& [value, bitmap] : bitmaps_) {
+                if (bitmap.contains(columnId)) {
+                    return std::make_tuple(value, true);
+                }
+            }
+        }
+        return std::make_tuple(0, false);
+    }
+
+    [[nodiscard]] auto valueExist(uint64_t columnId) const noexcept -> bool {
+        return existenceBitMap_.contains(columnId);
+    }
+
+    /**
+   * bsi_eq_ebm: 查询索引的ebm数组的roaringbitmap。
+   */
+    [[nodiscard]] auto getExistenceBitmap() const -> const Roaring64Map& {
+        return existenceBitMap_;
+    }
+
+    /**
+   * bsi_eq_distinct_count: 不同值的个数，即位图的个数。
+   */
+    [[nodiscard]] auto distinctCount() const -> size_t { return bitmaps_.size(); }
+
+    /**
+   * bsi_eq_bitmap: 值为 value 的行，没有这个值时返回 nullptr。
+   */
+    [[nodiscard]] auto getBitmap(uint64_t value) const -> const Roaring64Map* {
+        auto it = bitmaps_.find(value);
+        return it != bitmaps_.end() ? &it->second : nullptr;
+    }
+
+    /**
+   * bsi_eq_compare: 与 Roaring64Bsi::compare 相同的比较查询，支持LT/LE/GT/GE/EQ/NEQ/RANGE。
+   * EQ 是一次查找，其余的比较是满足条件的各个值的位图的 fastunion。
+   */
+    [[nodiscard]] auto compare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                               const Roaring64Map* foundSet = nullptr) const -> Roaring64MapPtr {
+        if (!Roaring64Bsi::isCompareOperation(operation)) {
+            return nullptr;
+        }
+
+        Roaring64MapPtr matched;
+        if (operation == NEQ) {
+            const auto* equal = getBitmap(startOrValue);
+            matched = std::make_unique<Roaring64Map>(equal != nullptr ? existenceBitMap_ - *equal
+                                                                      : existenceBitMap_);
+        } else {
+            matched = std::make_unique<Roaring64Map>(
+                    unionOf(matching(operation, startOrValue, end)));
+        }
+        if (foundSet != nullptr) {
+            *matched &= *foundSet;
+        }
+        return matched;
+    }
+
+    /**
+   * bsi_eq_count_compare: 只返回满足条件的个数，等价于 compare(...)->cardinality()。各个值的位图
+   * 互不相交，只需累加基数，不做 union。
+   */
+    [[nodiscard]] auto countCompare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                    const Roaring64Map* foundSet = nullptr) const -> uint64_t {
+        if (!Roaring64Bsi::isCompareOperation(operation)) {
+            return 0;
+        }
+
+        auto countOf = [foundSet](const Roaring64Map& bitmap) -> uint64_t {
+            return foundSet != nullptr ? bitmap.and_cardinality(*foundSet) : bitmap.cardinality();
+        };
+        if (operation == NEQ) {
+            const auto* equal = getBitmap(startOrValue);
+            return countOf(existenceBitMap_) - (equal != nullptr ? countOf(*equal) : 0);
+        }
+        uint64_t count = 0;
+        for (const auto* bitmap : matching(operation, startOrValue, end)) {
+            count += countOf(*bitmap);
+        }
+        return count;
+    }
+
+    /**
+   * bsi_eq_compare_in: 值属于 values 的行(IN 列表)，foundSet 非空时只在其中选取。
+   */
+    [[nodiscard]] auto compareIn(std::span<const uint64_t> values,
+                                 const Roaring64Map* foundSet = nullptr) const -> Roaring64MapPtr {
+        std::vector<uint64_t> distinct(values.begin(), values.end());
+        std::sort(distinct.begin(), distinct.end());
+        distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+        std::vector<const Roaring64Map*> bitmaps;
+        for (auto value : distinct) {
+            if (const auto* bitmap = getBitmap(value); bitmap != nullptr) {
+                bitmaps.push_back(bitmap);
+            }
+        }
+        auto matched = std::make_unique<Roaring64Map>(unionOf(bitmaps));
+        if (foundSet != nullptr) {
+            *matched &= *foundSet;
+        }
+        return matched;
+    }
+
+    /**
+   * bsi_eq_sum: 返回 foundSet(为空指针时为全部行)中有值的行的value之和与行数，sum 按 128 位累加。
+   */
+    [[nodiscard]] auto sum(const Roaring64Map* foundSet) const
+            -> std::tuple<unsigned __int128, uint64_t> {
+        unsigned __int128 sum = 0;
+        uint64_t count = 0;
+        for (const auto& [value, bitmap] : bitmaps_) {
+            const uint64_t rows = foundSet != nullptr ? bitmap.and_cardinality(*foundSet)
+                                                      : bitmap.cardinality();
+            sum += static_cast<unsigned __int128>(value) * rows;
+            count += rows;
+        }
+        return std::make_tuple(sum, count);
+    }
+
+    /**
+   * bsi_eq_topk: 返回 top k个最大value对应的行，foundSet 非空时只在其中选取。从最大的值开始取整个
+   * 位图，最后一个值的行不够全取时按 columnId 从小到大补足，与 Roaring64Bsi::topK 相同。
+   */
+    [[nodiscard]] auto topK(uint64_t k, const Roaring64Map* foundSet = nullptr) const
+            -> Roaring64MapPtr {
+        auto retBitmap = std::make_unique<Roaring64Map>();
+        for (auto it = bitmaps_.rbegin(); it != bitmaps_.rend() && k > 0; ++it) {
+            Roaring64Map rows = foundSet != nullptr ? it->second & *foundSet : it->second;
+            const uint64_t cardinality = rows.cardinality();
+            if (cardinality <= k) {
+                *retBitmap |= rows;
+                k -= cardinality;
+                continue;
+            }
+            for (auto row = rows.begin(); k > 0; ++row, k--) {
+                retBitmap->add(*row);
+            }
+        }
+        return retBitmap;
+    }
+
+    /**
+   * bsi_eq_to_bsi: 转换为二进制编码的BSI。
+   */
+    [[nodiscard]] auto toBsi() const -> std::unique_ptr<Roaring64Bsi> {
+        std::vector<std::pair<uint64_t, uint64_t>> rows;
+        rows.reserve(existenceBitMap_.cardinality());
+        for (const auto& [value, bitmap] : bitmaps_) {
+            for (auto columnId : bitmap) {
+                rows.emplace_back(columnId, value);
+            }
+        }
+        std::sort(rows.begin(), rows.end());
+
+        std::vector<uint64_t> columnIds(rows.size());
+        std::vector<uint64_t> values(rows.size());
+        for (size_t i = 0; i < rows.size(); i++) {
+            std::tie(columnIds[i], values[i]) = rows[i];
+        }
+        auto bsi = std::make_unique<Roaring64Bsi>();
+        bsi->setValuesSorted(columnIds, values);
+        return bsi;
+    }
+
+    void runOptimize() {
+        existenceBitMap_.runOptimize();
+        for (auto& [value, bitmap] : bitmaps_) {
+            bitmap.runOptimize();
+        }
+    }
+
+private:
+    // takes 'rows' out of every value bitmap, dropping the values left without rows
+    void removeRows(const Roaring64Map& rows) {
+        for (auto it = bitmaps_.begin(); it != bitmaps_.end();) {
+            it->second -= rows;
+            it = it->second.isEmpty() ? bitmaps_.erase(it) : std::next(it);
+        }
+    }
+
+    // the bitmaps of the values an operation other than NEQ matches, in ascending value order
+    [[nodiscard]] auto matching(BsiOperation operation, uint64_t startOrValue, uint64_t end) const
+            -> std::vector<const Roaring64Map*> {
+        uint64_t low = 0;
+        uint64_t high = UINT64_MAX;
+        switch (operation) {
+        case EQ:
+            low = high = startOrValue;
+            break;
+        case LT:
+            if (startOrValue == 0) {
+                return {};
+            }
+            high = startOrValue - 1;
+            break;
+        case LE:
+            high = startOrValue;
+            break;
+        case GT:
+            if (startOrValue == UINT64_MAX) {
+                return {};
+            }
+            low = startOrValue + 1;
+            break;
+        case GE:
+            low = startOrValue;
+            break;
+        case RANGE:
+            low = startOrValue;
+            high = end;
+            break;
+        default:
+            return {};
+        }
+
+        std::vector<const Roaring64Map*> bitmaps;
+        if (low <= high) {
+            for (auto it = bitmaps_.lower_bound(low); it != bitmaps_.end() && it->first <= high;
+                 ++it) {
+                bitmaps.push_back(&it->second);
+            }
+        }
+        return bitmaps;
+    }
+
+    static auto unionOf(std::vector<const Roaring64Map*> bitmaps) -> Roaring64Map {
+        if (bitmaps.empty()) {
+            return {};
+        }
+        if (bitmaps.size() == 1) {
+            return *bitmaps[0];
+        }
+        return Roaring64Map::fastunion(bitmaps.size(), bitmaps.data());
+    }
+
+    // value -> rows holding it; every bitmap is non-empty and the bitmaps are disjoint
+    std::map<uint64_t, Roaring64Map> bitmaps_;
+    Roaring64Map existenceBitMap_;
+};
+
+} // namespace roaring
+
+#endif /*INCLUDE_ROARING_64_EQUALITY_INDEX_HH_*/
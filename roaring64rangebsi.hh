@@ -0,0 +1,520 @@
+// Roaring64RangeBsi: 范围编码(Chan & Ioannidis)的BSI，第i个切片保存第i位为0的行，即 value 的第i位 <= 0。
+// 单边范围查询 value <= c 自低位向高位每一位只做一次 and 或 or，不需要 O'Neil 的多个累加器。
+
+#ifndef INCLUDE_ROARING_64_RANGE_BITMAP_SLICE_INDEX_HH_
+#define INCLUDE_ROARING_64_RANGE_BITMAP_SLICE_INDEX_HH_
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "roaring.hh"
+#include "roaring64bsi.hh"
+
+namespace roaring {
+
+class Roaring64RangeBsi {
+    using Roaring64MapPtr = std::unique_ptr<Roaring64Map>;
+    using Roaring64RangeBsiPtr = std::unique_ptr<Roaring64RangeBsi>;
+
+public:
+    /**
+   * bsi_range_from_bsi: 由二进制编码的BSI构造范围编码的BSI，第i个切片为 ebm - bsi.getSlice(i)，
+   * min/max 与 frame-of-reference 的 base 保持不变。
+   */
+    static auto fromBsi(const Roaring64Bsi& bsi) -> Roaring64RangeBsiPtr {
+        bsi.refreshMinMax();
+        auto rangeBsi = std::make_unique<Roaring64RangeBsi>();
+        rangeBsi->minValue_ = bsi.minValue_;
+        rangeBsi->maxValue_ = bsi.maxValue_;
+        rangeBsi->base_ = bsi.base_;
+        rangeBsi->runOptimized_ = bsi.runOptimized_;
+        rangeBsi->existenceBitMap_ = bsi.existenceBitMap_;
+        rangeBsi->slices_.reserve(bsi.bitCount());
+        for (size_t i = 0; i < bsi.bitCount(); i++) {
+            rangeBsi->slices_.emplace_back(bsi.existenceBitMap_ - bsi.slice(i));
+        }
+        return rangeBsi;
+    }
+
+    /**
+   * bsi_range_to_bsi: 转换回二进制编码的BSI。
+   */
+    [[nodiscard]] auto toBsi() const -> std::unique_ptr<Roaring64Bsi> {
+        auto bsi = std::make_unique<Roaring64Bsi>();
+        bsi->minValue_ = minValue_;
+        bsi->maxValue_ = maxValue_;
+        bsi->frameOfReference_ = base_ != 0;
+        bsi->base_ = base_;
+        bsi->runOptimized_ = runOptimized_;
+        bsi->existenceBitMap_ = existenceBitMap_;
+        bsi->indexBitMapVec_.reserve(bitCount());
+        for (const auto& slice : slices_) {
+            bsi->indexBitMapVec_.emplace_back(existenceBitMap_ - slice);
+        }
+        return bsi;
+    }
+
+    void setValue(uint64_t columnId, uint64_t value) {
+        ensureCapacity(value, value);
+        if (existenceBitMap_.contains(columnId)) {
+            for (auto& slice : slices_) {
+                slice.remove(columnId);
+            }
+        }
+        existenceBitMap_.add(columnId);
+
+        const uint64_t stored = value - base_;
+        for (size_t i = 0; i < bitCount(); i++) {
+            if (((stored >> i) & 1) == 0) {
+                slices_[i].add(columnId);
+            }
+        }
+    }
+
+    /**
+   * bsi_range_set_values: 批量设置 (columnId, value)，同一 columnId 以最后一行为准，与 setValue 相同。
+   */
+    void setValues(const std::vector<std::tuple<uint64_t, uint64_t>>& vec) {
+        if (vec.empty()) {
+            return;
+        }
+
+        // a later row for the same columnId overwrites the earlier ones, as with setValue: reversed
+        // and stably sorted, the row written last comes first among equal columnIds
+        std::vector<std::tuple<uint64_t, uint64_t>> rows(vec.rbegin(), vec.rend());
+        std::stable_sort(rows.begin(), rows.end(), [](const auto& left, const auto& right) {
+            return std::get<0>(left) < std::get<0>(right);
+        });
+        rows.erase(std::unique(rows.begin(), rows.end(),
+                               [](const auto& left, const auto& right) {
+                                   return std::get<0>(left) == std::get<0>(right);
+                               }),
+                   rows.end());
+
+        auto [minRow, maxRow] = std::minmax_element(
+                rows.begin(), rows.end(), [](const auto& left, const auto& right) {
+                    return std::get<1>(left) < std::get<1>(right);
+                });
+        ensureCapacity(std::get<1>(*minRow), std::get<1>(*maxRow));
+
+        std::vector<uint64_t> columnIds;
+        columnIds.reserve(rows.size());
+        for (const auto& row : rows) {
+            columnIds.push_back(std::get<0>(row));
+        }
+        Roaring64Map ids;
+        ids.addMany(columnIds.size(), columnIds.data());
+        auto overwritten = existenceBitMap_ & ids;
+        if (!overwritten.isEmpty()) {
+            for (auto& slice : slices_) {
+                slice -= overwritten;
+            }
+        }
+        existenceBitMap_ |= ids;
+
+        // one pass over the rows per slice, so only one slice's ids are buffered at a time
+        for (size_t i = 0; i < bitCount(); i++) {
+            columnIds.clear();
+            for (const auto& [columnId, value] : rows) {
+                if ((((value - base_) >> i) & 1) == 0) {
+                    columnIds.push_back(columnId);
+                }
+            }
+            slices_[i].addMany(columnIds.size(), columnIds.data());
+        }
+    }
+
+    [[nodiscard]] auto getValue(uint64_t columnId) const noexcept -> std::tuple<uint64_t, bool> {
+        if (!valueExist(columnId)) {
+            return std::make_tuple(0, false);
+        }
+
+        uint64_t stored = 0;
+        for (size_t i = 0; i < bitCount(); i++) {
+            if (!slices_[i].contains(columnId)) {
+                stored |= 1UL << i;
+            }
+        }
+        return std::make_tuple(stored + base_, true);
+    }
+
+    [[nodiscard]] auto valueExist(uint64_t columnId) const noexcept -> bool {
+        return existenceBitMap_.contains(columnId);
+    }
+
+    /**
+   * bsi_range_ebm: 查询BSI的ebm数组的roaringbitmap。
+   */
+    [[nodiscard]] auto getExistenceBitmap() const -> const Roaring64Map& {
+        return existenceBitMap_;
+    }
+
+    /**
+   * bsi_range_slice: 查询第i个范围编码切片，即第i位为0的行。
+   */
+    [[nodiscard]] auto getSlice(size_t i) const -> const Roaring64Map& {
+        if (i >= bitCount()) {
+            throw std::out_of_range(fmt::format("slice {} out of range", i));
+        }
+        return slices_[i];
+    }
+
+    [[nodiscard]] auto bitCount() const -> size_t { return slices_.size(); }
+
+    [[nodiscard]] auto getBase() const -> uint64_t { return base_; }
+
+    /**
+   * bsi_range_compare: 与 Roaring64Bsi::compare 相同的比较查询，支持LT/LE/GT/GE/EQ/NEQ/RANGE。
+   * LE/LT 自低位向高位每一位做一次 and 或 or，GE/GT 取其补集，RANGE 为两次 LE 之差。
+   */
+    [[nodiscard]] auto compare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                               const Roaring64Map* foundSet = nullptr) const -> Roaring64MapPtr {
+        if (!Roaring64Bsi::isCompareOperation(operation)) {
+            return nullptr;
+        }
+
+        auto allMatch =
+                Roaring64Bsi::decideByBounds(operation, startOrValue, end, minValue_, maxValue_);
+        if (allMatch.has_value()) {
+            if (!*allMatch) {
+                return std::make_unique<Roaring64Map>();
+            }
+            return std::make_unique<Roaring64Map>(
+                    foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_);
+        }
+
+        auto [candidates, lateFilter] = compareScope(foundSet);
+        auto matched = std::make_unique<Roaring64Map>(
+                scan(operation, startOrValue, end, candidates));
+        if (lateFilter != nullptr) {
+            *matched &= *lateFilter;
+        }
+        return matched;
+    }
+
+    /**
+   * bsi_range_count_compare: 只返回满足条件的个数，等价于 compare(...)->cardinality()。
+   */
+    [[nodiscard]] auto countCompare(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                                    const Roaring64Map* foundSet = nullptr) const -> uint64_t {
+        if (!Roaring64Bsi::isCompareOperation(operation)) {
+            return 0;
+        }
+
+        auto allMatch =
+                Roaring64Bsi::decideByBounds(operation, startOrValue, end, minValue_, maxValue_);
+        if (allMatch.has_value()) {
+            if (!*allMatch) {
+                return 0;
+            }
+            return foundSet != nullptr ? existenceBitMap_.and_cardinality(*foundSet)
+                                       : existenceBitMap_.cardinality();
+        }
+
+        auto [candidates, lateFilter] = compareScope(foundSet);
+        auto matched = scan(operation, startOrValue, end, candidates);
+        return lateFilter != nullptr ? matched.and_cardinality(*lateFilter)
+                                     : matched.cardinality();
+    }
+
+    /**
+   * bsi_range_sum: 返回 foundSet(为空指针时为全部行)中有值的行的value之和与行数。
+   * 第i位为1的行数是行数减去第i个切片中的行数。sum 按 128 位累加，与 Roaring64Bsi::sum 相同。
+   */
+    [[nodiscard]] auto sum(const Roaring64Map* foundSet) const
+            -> std::tuple<unsigned __int128, uint64_t> {
+        const uint64_t count = foundSet != nullptr ? existenceBitMap_.and_cardinality(*foundSet)
+                                                   : existenceBitMap_.cardinality();
+        const unsigned __int128 sum = Roaring64Bsi::weightedSum(bitCount(), count, [&](size_t i) {
+            const uint64_t zeros = foundSet != nullptr ? slices_[i].and_cardinality(*foundSet)
+                                                       : slices_[i].cardinality();
+            return count - zeros;
+        });
+        return std::make_tuple(sum + static_cast<unsigned __int128>(base_) * count, count);
+    }
+
+    /**
+   * bsi_range_topk: 返回 top k个最大value对应的行，foundSet 非空时只在其中选取，与 Roaring64Bsi::topK
+   * 相同。
+   */
+    [[nodiscard]] auto topK(uint64_t k, const Roaring64Map* foundSet = nullptr) const
+            -> Roaring64MapPtr {
+        if (k == 0 || (foundSet != nullptr && foundSet->isEmpty())) {
+            return std::make_unique<Roaring64Map>();
+        }
+
+        auto candidates = std::make_unique<Roaring64Map>(
+                foundSet != nullptr ? existenceBitMap_ & *foundSet : existenceBitMap_);
+        if (k >= candidates->cardinality()) {
+            return candidates;
+        }
+
+        auto retBitmap = std::make_unique<Roaring64Map>();
+        const uint64_t targetTopK = k;
+        uint64_t remaining = candidates->cardinality();
+        for (int32_t x = static_cast<int32_t>(bitCount()) - 1; x >= 0 && remaining > 0 && k > 0;
+             x--) {
+            // rows with bit x set are the candidates outside the range slice, counted without
+            // materializing them
+            const uint64_t cardinality = remaining - candidates->and_cardinality(slices_[x]);
+            if (cardinality > k) {
+                if (cardinality < remaining) {
+                    *candidates -= slices_[x];
+                }
+                remaining = cardinality;
+            } else if (cardinality > 0) {
+                *retBitmap |= *candidates - slices_[x];
+                *candidates &= slices_[x];
+                remaining -= cardinality;
+                k -= cardinality;
+            }
+        }
+
+        // the remaining candidates tie on the k-th value: take as many as still needed
+        uint64_t needed = targetTopK - retBitmap->cardinality();
+        for (auto it = candidates->begin(); needed > 0 && it != candidates->end(); ++it, needed--) {
+            retBitmap->add(*it);
+        }
+        return retBitmap;
+    }
+
+    void runOptimize() {
+        existenceBitMap_.runOptimize();
+        for (auto& slice : slices_) {
+            slice.runOptimize();
+        }
+        runOptimized_ = true;
+    }
+
+    /**
+   * bsi_range_serialized_size: serialize 需要的字节数。
+   */
+    [[nodiscard]] auto serializedSizeInBytes() const -> uint64_t {
+        uint64_t size = 0;
+        for (const auto& slice : slices_) {
+            size += slice.getSizeInBytes();
+        }
+        return 8 + 8 + 1 + (base_ != 0 ? 8 : 0) + existenceBitMap_.getSizeInBytes() + 4 + size;
+    }
+
+    /**
+   * bsi_range_serialize: 与 Roaring64Bsi::serialize 相同的格式，选项字节中标记范围编码，
+   * Roaring64Bsi::deserialize 读取时会转换回二进制编码。
+   */
+    auto serialize(char* buf) const -> size_t {
+        const char* orig = buf;
+        const uint8_t opt = (runOptimized_ ? 1 : 0) |
+                            (base_ != 0 ? Roaring64Bsi::frameOfReferenceFlag : 0) |
+                            Roaring64Bsi::rangeEncodedFlag;
+        std::memcpy(buf, &minValue_, sizeof(uint64_t));
+        buf += sizeof(uint64_t);
+        std::memcpy(buf, &maxValue_, sizeof(uint64_t));
+        buf += sizeof(uint64_t);
+        std::memcpy(buf, &opt, sizeof(uint8_t));
+        buf += sizeof(uint8_t);
+        if (base_ != 0) {
+            std::memcpy(buf, &base_, sizeof(uint64_t));
+            buf += sizeof(uint64_t);
+        }
+
+        auto ebmSize = existenceBitMap_.getSizeInBytes();
+        existenceBitMap_.write(buf);
+        buf += ebmSize;
+
+        const uint32_t bitDepth = bitCount();
+        std::memcpy(buf, &bitDepth, sizeof(uint32_t));
+        buf += sizeof(uint32_t);
+        for (const auto& slice : slices_) {
+            auto sliceSize = slice.getSizeInBytes();
+            slice.write(buf);
+            buf += sliceSize;
+        }
+        return buf - orig;
+    }
+
+    /**
+   * bsi_range_deserialize: 读取 serialize 或 Roaring64Bsi::serialize 的结果，二进制编码的切片会被
+   * 转换为范围编码。
+   */
+    void deserialize(const char* buf) {
+        uint8_t opt {0};
+        std::memcpy(&minValue_, buf, sizeof(uint64_t));
+        buf += sizeof(uint64_t);
+        std::memcpy(&maxValue_, buf, sizeof(uint64_t));
+        buf += sizeof(uint64_t);
+        std::memcpy(&opt, buf, sizeof(uint8_t));
+        buf += sizeof(uint8_t);
+
+        runOptimized_ = (opt & 1) != 0;
+        base_ = 0;
+        if ((opt & Roaring64Bsi::frameOfReferenceFlag) != 0) {
+            std::memcpy(&base_, buf, sizeof(uint64_t));
+            buf += sizeof(uint64_t);
+        }
+
+        existenceBitMap_ = Roaring64Map::read(buf);
+        buf += existenceBitMap_.getSizeInBytes();
+
+        uint32_t bitDepth = 0;
+        std::memcpy(&bitDepth, buf, sizeof(uint32_t));
+        buf += sizeof(uint32_t);
+
+        const bool rangeEncoded = (opt & Roaring64Bsi::rangeEncodedFlag) != 0;
+        slices_.clear();
+        slices_.reserve(bitDepth);
+        for (size_t i = 0; i < bitDepth; i++) {
+            auto slice = Roaring64Map::read(buf);
+            buf += slice.getSizeInBytes();
+            slices_.emplace_back(rangeEncoded ? std::move(slice) : existenceBitMap_ - slice);
+        }
+    }
+
+private:
+    // Widens min/max to [minValue, maxValue] and adds the slices the new maximum needs. Rows
+    // already in the index have 0 in every new bit, so a new slice starts out as the ebm.
+    void ensureCapacity(uint64_t minValue, uint64_t maxValue) {
+        if (existenceBitMap_.isEmpty()) {
+            slices_.clear();
+            base_ = 0;
+            minValue_ = minValue;
+            maxValue_ = maxValue;
+        } else {
+            if (minValue < base_) {
+                // only an index converted from a frame-of-reference one has a base
+                rebase(Roaring64Bsi::loweredBase(base_, minValue, bitCount()));
+            }
+            minValue_ = std::min(minValue_, minValue);
+            maxValue_ = std::max(maxValue_, maxValue);
+        }
+
+        const size_t bitDepth = std::max<size_t>(Roaring64Bsi::getBitDepth(maxValue_ - base_), 1);
+        while (bitCount() < bitDepth) {
+            slices_.emplace_back(existenceBitMap_);
+        }
+    }
+
+    // re-encodes every row for 'base' through the binary index, which owns the rebase logic
+    void rebase(uint64_t base) {
+        auto bsi = toBsi();
+        bsi->rebase(base);
+        *this = std::move(*fromBsi(*bsi));
+    }
+
+    /**
+     * Where a compare applies foundSet, as in Roaring64Bsi::compareScope: a selective foundSet
+     * restricts the scan, a large one is applied to the result. Returns the scan candidates
+     * (nullptr: every row) and the filter still to be applied, if any.
+     */
+    [[nodiscard]] auto compareScope(const Roaring64Map* foundSet) const
+            -> std::pair<std::unique_ptr<Roaring64Map>, const Roaring64Map*> {
+        if (foundSet != nullptr &&
+            static_cast<double>(foundSet->cardinality()) <
+                    Roaring64Bsi::foundSetPushDownRatio *
+                            static_cast<double>(existenceBitMap_.cardinality())) {
+            return {std::make_unique<Roaring64Map>(existenceBitMap_ & *foundSet), nullptr};
+        }
+        return {nullptr, foundSet};
+    }
+
+    /**
+     * Rows of 'candidates' (every row when nullptr) matching a predicate that min/max could not
+     * decide, which keeps every stored predicate below at or above base_.
+     */
+    [[nodiscard]] auto scan(BsiOperation operation, uint64_t startOrValue, uint64_t end,
+                            const std::unique_ptr<Roaring64Map>& candidates) const
+            -> Roaring64Map {
+        const Roaring64Map& all = candidates != nullptr ? *candidates : existenceBitMap_;
+        const Roaring64Map* scope = candidates.get();
+        switch (operation) {
+        case EQ:
+            return equal(startOrValue - base_, all);
+        case NEQ:
+            return all - equal(startOrValue - base_, all);
+        case LE:
+            return lessOrEqual(startOrValue - base_, scope);
+        case LT:
+            return lessOrEqual(startOrValue - 1 - base_, scope);
+        case GE:
+            return all - lessOrEqual(startOrValue - 1 - base_, scope);
+        case GT:
+            return all - lessOrEqual(startOrValue - base_, scope);
+        case RANGE: {
+            auto matched = lessOrEqual(std::min(end, maxValue_) - base_, scope);
+            if (startOrValue > minValue_) {
+                matched -= lessOrEqual(startOrValue - 1 - base_, scope);
+            }
+            return matched;
+        }
+        default:
+            return {};
+        }
+    }
+
+    /**
+     * Rows (of 'candidates' when not nullptr) whose stored value is <= predicate, bottom-up:
+     * with M the rows whose bits 0..i-1 are <= those of the predicate, the rows whose bits 0..i
+     * are <= those of the predicate are M & slice(i) where predicate bit i is 0 (bit i must be
+     * 0 too) and M | slice(i) where it is 1 (bit i is either lower, or equal with M deciding).
+     * The trailing ones of the predicate are skipped: every row is <= them.
+     */
+    [[nodiscard]] auto lessOrEqual(uint64_t predicate, const Roaring64Map* candidates) const
+            -> Roaring64Map {
+        const auto low = static_cast<size_t>(std::countr_one(predicate));
+        if (low >= bitCount()) {
+            return candidates != nullptr ? *candidates : existenceBitMap_;
+        }
+
+        Roaring64Map matched =
+                candidates != nullptr ? slices_[low] & *candidates : slices_[low];
+        for (size_t i = low + 1; i < bitCount(); i++) {
+            if (((predicate >> i) & 1) == 1) {
+                if (candidates != nullptr) {
+                    matched |= slices_[i] & *candidates;
+                } else {
+                    matched |= slices_[i];
+                }
+            } else if (!matched.isEmpty()) {
+                matched &= slices_[i];
+            }
+        }
+        return matched;
+    }
+
+    // rows of 'candidates' whose stored value equals predicate, top-down as in O'Neil's EQ
+    [[nodiscard]] auto equal(uint64_t predicate, const Roaring64Map& candidates) const
+            -> Roaring64Map {
+        if (Roaring64Bsi::getBitDepth(predicate) > bitCount()) {
+            return {};
+        }
+        Roaring64Map matched = candidates;
+        for (int32_t i = static_cast<int32_t>(bitCount()) - 1; i >= 0 && !matched.isEmpty();
+             i--) {
+            if (((predicate >> i) & 1) == 1) {
+                matched -= slices_[i];
+            } else {
+                matched &= slices_[i];
+            }
+        }
+        return matched;
+    }
+
+    // bounds of the values; overwrites only widen them, as in Roaring64Bsi
+    uint64_t minValue_ {0};
+    uint64_t maxValue_ {0};
+    // the slices hold value - base_, see Roaring64Bsi::rebase
+    uint64_t base_ {0};
+    bool runOptimized_ {false};
+
+    // slices_[i] holds the rows whose stored value has bit i clear
+    std::vector<Roaring64Map> slices_;
+    Roaring64Map existenceBitMap_;
+};
+
+} // namespace roaring
+
+#endif /*INCLUDE_ROARING_64_RANGE_BITMAP_SLICE_INDEX_HH_*/
@@ -0,0 +1,128 @@
+// 简单线程池，供 Roaring64Bsi 按高32位分块并行计算使用。
+
+#ifndef INCLUDE_ROARING_BSI_THREAD_POOL_HH_
+#define INCLUDE_ROARING_BSI_THREAD_POOL_HH_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace roaring {
+
+class ThreadPool {
+public:
+    /**
+     * threadCount threads work on each parallelFor: the calling thread plus threadCount - 1
+     * workers owned by the pool.
+     */
+    explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency()) {
+        threadCount = std::max<size_t>(threadCount, 1);
+        workers_.reserve(threadCount - 1);
+        for (size_t i = 1; i < threadCount; i++) {
+            workers_.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        condition_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] auto size() const -> size_t { return workers_.size() + 1; }
+
+    template <typename Fn>
+    auto submit(Fn&& fn) -> std::future<std::invoke_result_t<Fn>> {
+        using Result = std::invoke_result_t<Fn>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Fn>(fn));
+        auto future = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.emplace([task] { (*task)(); });
+        }
+        condition_.notify_one();
+        return future;
+    }
+
+    /**
+     * Runs fn(0) .. fn(taskCount - 1) on the pool and the calling thread, and returns once all of
+     * them are done. The first exception thrown by fn is rethrown.
+     */
+    void parallelFor(size_t taskCount, const std::function<void(size_t)>& fn) {
+        std::atomic<size_t> next {0};
+        auto drain = [&next, taskCount, &fn] {
+            for (size_t i = next.fetch_add(1); i < taskCount; i = next.fetch_add(1)) {
+                fn(i);
+            }
+        };
+
+        std::vector<std::future<void>> helpers;
+        size_t helperCount = std::min(workers_.size(), taskCount > 0 ? taskCount - 1 : 0);
+        helpers.reserve(helperCount);
+        for (size_t i = 0; i < helperCount; i++) {
+            helpers.emplace_back(submit(drain));
+        }
+
+        std::exception_ptr error;
+        try {
+            drain();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        for (auto& helper : helpers) {
+            try {
+                helper.get();
+            } catch (...) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    void workerLoop() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (stopping_ && tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stopping_ {false};
+};
+
+} // namespace roaring
+
+#endif /*INCLUDE_ROARING_BSI_THREAD_POOL_HH_*/